@@ -0,0 +1,354 @@
+// Headless throughput benchmark of the Game of Life engines: loads a
+// pattern (or makes a random soup), runs it for a number of generations as
+// fast as every engine can and reports speed, final population and a hash
+// of the final cells, so that runs can be compared between commits.
+//
+// Bounded engines (naive, packed, threaded, blocked, processes) treat everything outside the
+// board as dead, unbounded ones (sparse, hashlife) don't. Their results
+// match as long as the pattern stays away from the edges.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+#include "life.hpp"
+#include "bands.hpp"
+#include "board.hpp"
+#include "blocking.hpp"
+#include "domain.hpp"
+#include "sparse.hpp"
+#include "hashlife.hpp"
+#include "pattern.hpp"
+
+const char *ENGINES[] = { "naive", "packed", "threaded", "blocked", "processes", "sparse", "hashlife" };
+const int ENGINE_COUNT = sizeof(ENGINES) / sizeof(ENGINES[0]);
+
+struct options_t
+{
+    const char *pattern = nullptr;
+    const char *engine = "all";
+    int width = 2048;
+    int height = 2048;
+    uint64_t generations = 1000;
+    int threads = std::thread::hardware_concurrency();
+    int processes = 4;
+    uint32_t seed = 1;
+    size_t hashlife_memory = size_t(1) << 30;
+};
+
+struct result_t
+{
+    double seconds;
+    uint64_t population;
+    uint64_t hash;
+};
+
+options_t options;
+life_rule_t rule = LIFE_CONWAY;
+// Initial cells, the same for every engine
+board_t start;
+
+// Hash of the set of live cells: a sum of per-cell hashes, so engines can
+// produce cells in any order
+uint64_t cell_hash(int64_t x, int64_t y)
+{
+    uint64_t h = uint64_t(x) * 0x9E3779B97F4A7C15ull ^ uint64_t(y) * 0xC2B2AE3D27D4EB4Full;
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 29;
+    return h;
+}
+
+void hash_word(uint64_t word, int64_t x, int64_t y, result_t &result)
+{
+    for (; word; word &= word - 1) {
+        result.population++;
+        result.hash += cell_hash(x + life_ctz(word), y);
+    }
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start_time)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+// The original game: a byte per cell, 8 neighbours counted one by one
+result_t run_naive()
+{
+    const int w = start.width, h = start.height;
+    // With a dead border, so that neighbours need no bounds checks
+    const int stride = w + 2;
+    std::vector<uint8_t> cells(size_t(stride) * (h + 2)), next(cells.size());
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x)
+            cells[(y + 1) * stride + x + 1] = board_get(&start, x, y);
+
+    const auto time = std::chrono::steady_clock::now();
+    for (uint64_t g = 0; g < options.generations; ++g) {
+        for (int y = 1; y <= h; ++y) {
+            for (int x = 1; x <= w; ++x) {
+                const uint8_t *c = &cells[y * stride + x];
+                const int alive = c[-stride - 1] + c[-stride] + c[-stride + 1] +
+                                  c[-1] + c[1] +
+                                  c[stride - 1] + c[stride] + c[stride + 1];
+                next[y * stride + x] = ((*c ? rule.survive : rule.birth) >> alive) & 1;
+            }
+        }
+        cells.swap(next);
+    }
+    result_t result = { seconds_since(time), 0, 0 };
+
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x)
+            if (cells[(y + 1) * stride + x + 1])
+                hash_word(1, x, y, result);
+    return result;
+}
+
+// Bit-packed board with the widest vector kernel, stepped in bands
+result_t run_packed(int threads)
+{
+    board_t board = start;
+    life_bands_t bands;
+    life_bands_init(&bands, threads);
+    const life_row_kernel kernel = life_select_row_kernel(rule);
+
+    const auto time = std::chrono::steady_clock::now();
+    for (uint64_t g = 0; g < options.generations; ++g)
+        board_step(&board, &bands, kernel, rule);
+    result_t result = { seconds_since(time), 0, 0 };
+    life_bands_destroy(&bands);
+
+    for (int y = 0; y < board.height; ++y) {
+        const uint64_t *row = board_row(&board, y);
+        for (int i = 0; i < board.words; ++i)
+            hash_word(row[i], i * 64, y, result);
+    }
+    return result;
+}
+
+// Threaded, with tiles stepped several generations at a time in the cache
+result_t run_blocked()
+{
+    board_t board = start;
+    life_bands_t bands;
+    life_bands_init(&bands, options.threads);
+    blocking_t blocking;
+    const life_row_kernel kernel = life_select_row_kernel(rule);
+
+    const auto time = std::chrono::steady_clock::now();
+    blocking_advance(&blocking, &board, &bands, kernel, rule, options.generations);
+    result_t result = { seconds_since(time), 0, 0 };
+    life_bands_destroy(&bands);
+
+    for (int y = 0; y < board.height; ++y) {
+        const uint64_t *row = board_row(&board, y);
+        for (int i = 0; i < board.words; ++i)
+            hash_word(row[i], i * 64, y, result);
+    }
+    return result;
+}
+
+// Strips of the board in forked processes, trading edge rows through shared
+// memory. The time includes starting them and copying the board in and out.
+result_t run_processes()
+{
+#if DOMAIN_SUPPORTED
+    domain_t domain;
+    if (!domain_create(&domain, options.processes, start.width, start.height)) {
+        perror("processes: shared memory");
+        return { 0, 0, 0 };
+    }
+    for (int y = 0; y < start.height; ++y)
+        memcpy(domain_row(&domain, y), board_row(&start, y), start.words * sizeof(uint64_t));
+    const life_row_kernel kernel = life_select_row_kernel(rule);
+
+    const auto time = std::chrono::steady_clock::now();
+    const bool ok = domain_advance(&domain, kernel, rule, options.generations);
+    result_t result = { seconds_since(time), 0, 0 };
+    if (!ok)
+        fprintf(stderr, "processes: a process failed\n");
+
+    for (int y = 0; ok && y < start.height; ++y) {
+        const uint64_t *row = domain_row(&domain, y);
+        for (int i = 0; i < start.words; ++i)
+            hash_word(row[i], i * 64, y, result);
+    }
+    domain_destroy(&domain);
+    return result;
+#else
+    fprintf(stderr, "processes: needs POSIX shared memory\n");
+    return { 0, 0, 0 };
+#endif
+}
+
+result_t run_sparse()
+{
+    sparse_t universe;
+    for (int y = 0; y < start.height; ++y)
+        for (int x = 0; x < start.width; ++x)
+            if (board_get(&start, x, y))
+                sparse_set(&universe, x, y, true);
+    const life_row_kernel kernel = life_select_row_kernel(rule, false);
+
+    const auto time = std::chrono::steady_clock::now();
+    for (uint64_t g = 0; g < options.generations; ++g)
+        sparse_step(&universe, kernel, rule);
+    result_t result = { seconds_since(time), 0, 0 };
+
+    for (auto &it : universe.chunks) {
+        const int64_t x = sparse_key_x(it.first) * SPARSE_CHUNK;
+        const int64_t y = sparse_key_y(it.first) * SPARSE_CHUNK;
+        for (int i = 0; i < SPARSE_CHUNK; ++i)
+            hash_word(it.second->rows[i], x, y + i, result);
+    }
+    sparse_destroy(&universe);
+    return result;
+}
+
+result_t run_hashlife()
+{
+    hashlife_t store;
+    hashlife_t *h = &store;
+    hashlife_init(h, options.hashlife_memory);
+    hashlife_set_rule(h, rule);
+    hashlife_load_rows(h, start.width, start.height, [](int64_t y) { return board_row(&start, y); });
+
+    const auto time = std::chrono::steady_clock::now();
+    hashlife_advance(h, options.generations);
+    result_t result = { seconds_since(time), 0, 0 };
+
+    hashlife_for_each(h, INT64_MIN / 2, INT64_MIN / 2, INT64_MAX / 2, INT64_MAX / 2,
+                      [&](int64_t x, int64_t y) { hash_word(1, x, y, result); });
+    return result;
+}
+
+result_t run_engine(int engine)
+{
+    switch (engine) {
+    case 0: return run_naive();
+    case 1: return run_packed(1);
+    case 2: return run_packed(options.threads);
+    case 3: return run_blocked();
+    case 4: return run_processes();
+    case 5: return run_sparse();
+    default: return run_hashlife();
+    }
+}
+
+bool load_start()
+{
+    if (!options.pattern) {
+        // Random soup, a third of the cells alive
+        board_resize(&start, options.width, options.height);
+        std::mt19937 random(options.seed);
+        for (int y = 0; y < start.height; ++y)
+            for (int x = 0; x < start.width; ++x)
+                if (random() % 3 == 0)
+                    board_set(&start, x, y, true);
+        return true;
+    }
+
+    // The board is at least as big as the pattern, which goes in the middle
+    int64_t left = 0, top = 0;
+    const auto begin = [&](const pattern_info_t &info) {
+        if (!life_parse_rule(info.rule, rule)) {
+            fprintf(stderr, "%s: only two-state B/S rules can be benchmarked, not %s\n",
+                    options.pattern, info.rule);
+            return false;
+        }
+        const int w = std::max<int64_t>(options.width, info.width);
+        const int h = std::max<int64_t>(options.height, info.height);
+        board_resize(&start, w, h);
+        left = (w - info.width) / 2;
+        top = (h - info.height) / 2;
+        return true;
+    };
+    return pattern_load(options.pattern, begin, [&](int64_t x, int64_t y, int64_t length) {
+        board_set_run(&start, left + x, top + y, length);
+    });
+}
+
+void usage()
+{
+    fprintf(stderr,
+            "Usage: game-of-life-bench [options] [pattern.rle]\n"
+            "  --engine NAME   all, naive, packed, threaded, blocked, processes, sparse\n"
+            "                  or hashlife (all)\n"
+            "  --gens N        generations to run (1000)\n"
+            "  --size WxH      board size, at least the pattern size (2048x2048)\n"
+            "  --threads N     threads of the threaded and blocked engines (all cores)\n"
+            "  --processes N   processes of the processes engine (4)\n"
+            "  --rule RULE     B/S rule when there is no pattern (B3/S23)\n"
+            "  --seed N        seed of the random soup (1)\n"
+            "  --memory MB     Hashlife node store limit (1024)\n");
+}
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--engine") == 0 && has_value) {
+            options.engine = argv[++i];
+        } else if (strcmp(argv[i], "--gens") == 0 && has_value) {
+            options.generations = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--size") == 0 && has_value) {
+            if (sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2 ||
+                options.width <= 0 || options.height <= 0) {
+                usage();
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            options.threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--processes") == 0 && has_value) {
+            options.processes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--rule") == 0 && has_value) {
+            if (!life_parse_rule(argv[++i], rule)) {
+                usage();
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            options.seed = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--memory") == 0 && has_value) {
+            options.hashlife_memory = strtoull(argv[++i], nullptr, 10) << 20;
+        } else if (argv[i][0] == '-') {
+            usage();
+            return 1;
+        } else {
+            options.pattern = argv[i];
+        }
+    }
+    if (!load_start())
+        return 1;
+
+    char rule_text[32];
+    life_format_rule(rule, rule_text, sizeof(rule_text));
+    printf("%s, %dx%d, %s, %llu generations, %d threads\n",
+           options.pattern ? options.pattern : "random soup", start.width, start.height, rule_text,
+           (unsigned long long) options.generations, options.threads);
+    // Unbounded engines are rated by the board area too, as the work they
+    // save is the point of them
+    printf("%-10s %10s %12s %14s %12s %18s\n",
+           "engine", "seconds", "gens/s", "cell-upd/s", "population", "hash");
+
+    bool found = false;
+    for (int engine = 0; engine < ENGINE_COUNT; ++engine) {
+        if (strcmp(options.engine, "all") != 0 && strcmp(options.engine, ENGINES[engine]) != 0)
+            continue;
+        found = true;
+        const result_t result = run_engine(engine);
+        const double gens_per_second = options.generations / result.seconds;
+        printf("%-10s %10.3f %12.1f %14.3e %12llu   %016llx\n", ENGINES[engine], result.seconds,
+               gens_per_second, gens_per_second * start.width * start.height,
+               (unsigned long long) result.population, (unsigned long long) result.hash);
+        fflush(stdout);
+    }
+    if (!found) {
+        usage();
+        return 1;
+    }
+    return 0;
+}
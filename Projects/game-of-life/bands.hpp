@@ -0,0 +1,287 @@
+#ifndef BANDS_HPP
+#define BANDS_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "life.hpp"
+
+// Multithreaded step of a packed board: the rows are split into horizontal
+// bands, one per thread. A band reads the row above and below it from its
+// neighbours (the halo) and writes only its own rows of the next
+// generation, so bands need no locking. Threads are started once and meet
+// at a barrier at the start and at the end of every generation.
+
+// Bands smaller than this many words are not worth waking a thread for
+const size_t LIFE_MIN_BAND_WORDS = size_t(1) << 14;
+
+struct life_barrier_t
+{
+    std::mutex lock;
+    std::condition_variable cv;
+    int count;
+    int waiting;
+    uint64_t phase;
+};
+
+inline void life_barrier_init(life_barrier_t *b, int count)
+{
+    b->count = count;
+    b->waiting = 0;
+    b->phase = 0;
+}
+
+// Blocks until `count` threads have arrived, then releases all of them
+inline void life_barrier_wait(life_barrier_t *b)
+{
+    std::unique_lock<std::mutex> lock(b->lock);
+    const uint64_t phase = b->phase;
+    if (++b->waiting == b->count) {
+        b->waiting = 0;
+        b->phase++;
+        b->cv.notify_all();
+    } else {
+        b->cv.wait(lock, [&] { return b->phase != phase; });
+    }
+}
+
+// Where a step changed the cells, coarsely, for whatever is derived from
+// them to catch up without a pass over the whole board: a unit is one word
+// column of LIFE_DIRTY_ROWS rows. Bands list the units whose words changed,
+// each band in a list of its own, and flag them so that a unit is listed
+// once. Whoever reads the lists clears them and the flags of their units.
+const int LIFE_DIRTY_ROWS = 8;
+
+struct life_dirty_t
+{
+    int64_t columns = 0; // Words in a row, units in a row of units
+    std::vector<uint8_t> flags;
+    std::vector<std::vector<uint64_t>> lists;
+    // Per band, the changed bits of every word of the row of units being
+    // stepped, ORed over its rows
+    std::vector<std::vector<uint64_t>> changes;
+};
+
+// Sets up tracking for a board of `words` x `rows`, nothing changed yet
+inline void life_dirty_reset(life_dirty_t *d, int words, int rows)
+{
+    d->columns = words;
+    d->flags.assign(size_t((rows + LIFE_DIRTY_ROWS - 1) / LIFE_DIRTY_ROWS) * words, 0);
+    for (std::vector<uint64_t> &list : d->lists)
+        list.clear();
+}
+
+struct life_bands_t
+{
+    std::vector<std::thread> threads;
+    life_barrier_t start, done;
+    bool quit;
+
+    // Current generation, written before `start` and read by all threads
+    life_row_kernel kernel;
+    life_rule_t rule;
+    const uint64_t *src;
+    uint64_t *dst;
+    ptrdiff_t stride;
+    int rows;
+    int words;
+    uint64_t last_mask;
+    int bands;
+    // Hashes of the words that changed in every band, when hashing
+    bool hashing;
+    std::vector<uint64_t> hashes;
+    // Births, deaths and bounding box of every band, when counting
+    bool counting;
+    std::vector<life_stats_t> stats;
+    life_change_counter count_changes;
+    // Units with changes, when tracking them
+    life_dirty_t *dirty;
+    // Something else to run on the threads instead of a generation, see
+    // life_bands_parallel()
+    void (*job)(void *context, int band, int bands);
+    void *context;
+};
+
+// Adds the changes of row y of band i to its row of units, and lists the
+// units that changed at the last row of it
+inline void life_bands_track(life_bands_t *p, int i, const uint64_t *row, const uint64_t *out, int y, bool last)
+{
+    life_dirty_t *dirty = p->dirty;
+    uint64_t *changes = dirty->changes[i].data();
+    const int words = p->words;
+    // Whole words compared without a branch, so that this vectorizes
+    for (int x = 0; x < words - 1; ++x)
+        changes[x] |= row[x] ^ out[x];
+    changes[words - 1] |= (row[words - 1] & p->last_mask) ^ out[words - 1];
+    if (!last && y % LIFE_DIRTY_ROWS != LIFE_DIRTY_ROWS - 1)
+        return;
+
+    std::vector<uint64_t> &list = dirty->lists[i];
+    const size_t first = size_t(y / LIFE_DIRTY_ROWS) * words;
+    uint8_t *flags = &dirty->flags[first];
+    for (int x = 0; x < words; ++x) {
+        if (changes[x] && !flags[x]) {
+            flags[x] = 1;
+            list.push_back(first + x);
+        }
+        changes[x] = 0;
+    }
+}
+
+// Steps band i of the current generation
+inline void life_bands_run(life_bands_t *p, int i)
+{
+    if (i >= p->bands)
+        return;
+    if (p->job) {
+        p->job(p->context, i, p->bands);
+        return;
+    }
+    // Bands tracking changes start on a row of units, so that no two of
+    // them flag the same unit
+    const int align = p->dirty ? LIFE_DIRTY_ROWS : 1;
+    const int y0 = int(int64_t(p->rows) * i / p->bands) / align * align;
+    const int y1 = i + 1 == p->bands ? p->rows : int(int64_t(p->rows) * (i + 1) / p->bands) / align * align;
+    uint64_t hash = 0;
+    life_stats_t &stats = p->stats[i];
+    stats.births = stats.deaths = 0;
+    life_stats_empty_bounds(stats);
+    for (int y = y0; y < y1; ++y) {
+        const uint64_t *row = p->src + y * p->stride;
+        uint64_t *out = p->dst + y * p->stride;
+        p->kernel(p->rule, row - p->stride, row, row + p->stride, out, p->words, p->last_mask);
+        // Both rows are still in the cache. Bits past the last cell may
+        // be ghosts of a torus.
+        if (p->hashing) {
+            for (int x = 0; x < p->words; ++x) {
+                const uint64_t old = x == p->words - 1 ? row[x] & p->last_mask : row[x];
+                if (old != out[x])
+                    hash ^= life_word_hash(x, y, old) ^ life_word_hash(x, y, out[x]);
+            }
+        }
+        if (p->counting) {
+            p->count_changes(stats, row, out, p->words, p->last_mask);
+            life_stats_add_row(stats, out, p->words, y);
+        }
+        if (p->dirty)
+            life_bands_track(p, i, row, out, y, y == y1 - 1);
+    }
+    p->hashes[i] = hash;
+}
+
+inline void life_bands_worker(life_bands_t *p, int i)
+{
+    for (;;) {
+        life_barrier_wait(&p->start);
+        if (p->quit)
+            return;
+        life_bands_run(p, i);
+        life_barrier_wait(&p->done);
+    }
+}
+
+// Starts `threads` - 1 workers, the calling thread steps the first band
+inline void life_bands_init(life_bands_t *p, int threads)
+{
+    threads = std::max(threads, 1);
+    life_barrier_init(&p->start, threads);
+    life_barrier_init(&p->done, threads);
+    p->quit = false;
+    p->hashes.assign(threads, 0);
+    p->stats.assign(threads, life_stats_t());
+    p->count_changes = life_select_change_counter();
+    for (int i = 1; i < threads; ++i)
+        p->threads.emplace_back(life_bands_worker, p, i);
+}
+
+inline void life_bands_destroy(life_bands_t *p)
+{
+    if (!p->threads.empty()) {
+        p->quit = true;
+        life_barrier_wait(&p->start);
+        for (std::thread &t : p->threads)
+            t.join();
+        p->threads.clear();
+    }
+}
+
+// Computes `rows` rows of the next generation from `src` into `dst`. Both
+// point at the first row of a board with rows `stride` words apart and
+// guard rows and words around, as life_step_row() expects. If `hash` isn't
+// null, the life_word_hash() of every word that changed is XORed into it,
+// with (0, 0) the first word of `src`. If `stats` isn't null, it goes from
+// the stats of this generation to those of the next one. If `dirty` isn't
+// null, the units that changed are flagged and listed in it.
+inline void life_bands_step(life_bands_t *p, life_row_kernel kernel, const life_rule_t &rule,
+                            const uint64_t *src, uint64_t *dst, ptrdiff_t stride,
+                            int rows, int words, uint64_t last_mask, uint64_t *hash = nullptr,
+                            life_stats_t *stats = nullptr, life_dirty_t *dirty = nullptr)
+{
+    p->kernel = kernel;
+    p->rule = rule;
+    p->src = src;
+    p->dst = dst;
+    p->stride = stride;
+    p->rows = rows;
+    p->words = words;
+    p->last_mask = last_mask;
+    p->hashing = hash != nullptr;
+    p->counting = stats != nullptr;
+    p->dirty = dirty;
+    p->job = nullptr;
+    const size_t max_bands = std::max<size_t>(size_t(rows) * words / LIFE_MIN_BAND_WORDS, 1);
+    p->bands = int(std::min(p->threads.size() + 1, max_bands));
+    if (dirty) {
+        // Lists stay until they are read, whatever the bands of this step
+        dirty->lists.resize(std::max(dirty->lists.size(), size_t(p->bands)));
+        dirty->changes.resize(p->bands);
+        for (std::vector<uint64_t> &changes : dirty->changes)
+            changes.assign(words, 0);
+    }
+
+    // Small boards are done on the calling thread without waking anyone
+    if (p->bands == 1) {
+        life_bands_run(p, 0);
+    } else {
+        life_barrier_wait(&p->start);
+        life_bands_run(p, 0);
+        life_barrier_wait(&p->done);
+    }
+    if (hash)
+        for (int i = 0; i < p->bands; ++i)
+            *hash ^= p->hashes[i];
+    if (stats) {
+        stats->births = stats->deaths = 0;
+        life_stats_empty_bounds(*stats);
+        for (int i = 0; i < p->bands; ++i) {
+            const life_stats_t &band = p->stats[i];
+            stats->births += band.births;
+            stats->deaths += band.deaths;
+            life_stats_add_bounds(*stats, band.x0, band.y0, band.x1, band.y1);
+        }
+        stats->population += stats->births - stats->deaths;
+    }
+}
+
+// Runs job(context, i, n) for every band i < n on the threads of the bands,
+// with n at most `bands` and one band per thread
+inline void life_bands_parallel(life_bands_t *p, int bands, void (*job)(void *context, int band, int bands),
+                                void *context)
+{
+    p->job = job;
+    p->context = context;
+    p->bands = std::max(std::min(bands, int(p->threads.size()) + 1), 1);
+    if (p->bands == 1) {
+        life_bands_run(p, 0);
+    } else {
+        life_barrier_wait(&p->start);
+        life_bands_run(p, 0);
+        life_barrier_wait(&p->done);
+    }
+}
+
+#endif // BANDS_HPP
@@ -0,0 +1,136 @@
+#ifndef BLOCKING_HPP
+#define BLOCKING_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "life.hpp"
+#include "bands.hpp"
+#include "board.hpp"
+
+// Temporal blocking: a board bigger than the cache is streamed through
+// memory once per generation by board_step(), and the kernels spend most of
+// their time waiting for it. Instead, blocking_advance() copies a tile of
+// the board with a halo around it into a small scratch buffer and steps it
+// several generations there before moving on to the next tile, so memory is
+// read and written once per pass of up to BLOCKING_GENERATIONS generations.
+//
+// Cells near a cut edge of the scratch are wrong, their neighbours outside
+// weren't copied, and the error spreads a cell per generation. The halo
+// keeps it away from the tile: BLOCKING_GENERATIONS rows above and below,
+// and a word of 64 cells on each side. Rows already hit by the error aren't
+// computed, so the stepped rows shrink by one at every cut edge every
+// generation, a trapezoid that ends at the tile itself. Halos overlap
+// between tiles and are computed by both, the price of fewer passes over
+// memory. Tiles on the board's edges need no halo there, cells outside the
+// board are dead anyway.
+//
+// Tiles are stepped in parallel by the threads of the bands: they read only
+// the current buffer and write only their own part of the other one.
+
+// Words of a scratch row, the halo words included: a whole number of
+// vectors, so that kernels need no padding past them. With the rows below,
+// the two scratch buffers of a thread take about 670 KB, in the L2 cache of
+// most CPUs.
+const int BLOCKING_WORDS = 128;
+// Rows of a tile, without the halo
+const int BLOCKING_ROWS = 256;
+// Generations of a pass. The halo word allows up to 64.
+const int BLOCKING_GENERATIONS = 32;
+const int BLOCKING_STRIDE = BLOCKING_WORDS + 2;
+
+struct blocking_scratch_t
+{
+    std::vector<uint64_t> buffers[2];
+};
+
+struct blocking_t
+{
+    // One per band
+    std::vector<blocking_scratch_t> scratch;
+    // Current pass, read by all bands
+    board_t *board;
+    life_row_kernel kernel;
+    life_rule_t rule;
+    int generations;
+};
+
+// Steps rows [y0, y1) x words [x0, x1) of the board `p->generations`
+// generations into the other buffer
+inline void blocking_tile(blocking_t *p, blocking_scratch_t *s, int y0, int y1, int x0, int x1)
+{
+    board_t *b = p->board;
+    const int generations = p->generations;
+    const int sy0 = std::max(y0 - generations, 0), sy1 = std::min(y1 + generations, b->height);
+    const int sx0 = std::max(x0 - 1, 0), sx1 = std::min(x1 + 1, b->words);
+    const int words = sx1 - sx0;
+    const uint64_t last_mask = sx1 == b->words ? life_last_mask(b->width) : ~uint64_t(0);
+    // Row y of the board in scratch buffer k, with guard rows and words
+    const auto row = [&](int k, int y) {
+        return s->buffers[k].data() + size_t(y - sy0 + 1) * BLOCKING_STRIDE + 1;
+    };
+
+    const size_t size = size_t(sy1 - sy0 + 2) * BLOCKING_STRIDE * sizeof(uint64_t);
+    memset(s->buffers[0].data(), 0, size);
+    memset(s->buffers[1].data(), 0, size);
+    for (int y = sy0; y < sy1; ++y)
+        memcpy(row(0, y), board_row(b, y) + sx0, words * sizeof(uint64_t));
+
+    for (int t = 1; t <= generations; ++t) {
+        const int from = sy0 == 0 ? 0 : sy0 + t;
+        const int to = sy1 == b->height ? b->height : sy1 - t;
+        const int src = (t - 1) & 1, dst = t & 1;
+        for (int y = from; y < to; ++y)
+            p->kernel(p->rule, row(src, y - 1), row(src, y), row(src, y + 1), row(dst, y), words, last_mask);
+    }
+
+    for (int y = y0; y < y1; ++y)
+        memcpy(board_row(b, y, !b->current) + x0, row(generations & 1, y) + (x0 - sx0),
+               (x1 - x0) * sizeof(uint64_t));
+}
+
+// Band i of n steps its share of the rows of tiles, all of their columns
+inline void blocking_run(void *context, int band, int bands)
+{
+    blocking_t *p = (blocking_t *) context;
+    board_t *b = p->board;
+    const int tile_rows = (b->height + BLOCKING_ROWS - 1) / BLOCKING_ROWS;
+    const int tile_words = BLOCKING_WORDS - 2;
+    for (int i = tile_rows * band / bands; i < tile_rows * (band + 1) / bands; ++i)
+        for (int x = 0; x < b->words; x += tile_words)
+            blocking_tile(p, &p->scratch[band], i * BLOCKING_ROWS, std::min((i + 1) * BLOCKING_ROWS, b->height),
+                          x, std::min(x + tile_words, b->words));
+}
+
+// Advances the board by `generations`, same as as many board_step() calls.
+// A torus needs its ghosts filled every generation and is stepped one
+// generation at a time.
+inline void blocking_advance(blocking_t *p, board_t *b, life_bands_t *bands, life_row_kernel kernel,
+                             const life_rule_t &rule, uint64_t generations)
+{
+    if (b->torus) {
+        for (uint64_t i = 0; i < generations; ++i)
+            board_step(b, bands, kernel, rule);
+        return;
+    }
+    const int threads = int(bands->threads.size()) + 1;
+    if (int(p->scratch.size()) < threads) {
+        p->scratch.resize(threads);
+        for (blocking_scratch_t &s : p->scratch)
+            for (std::vector<uint64_t> &buffer : s.buffers)
+                buffer.assign(size_t(BLOCKING_ROWS + 2 * BLOCKING_GENERATIONS + 2) * BLOCKING_STRIDE, 0);
+    }
+    p->board = b;
+    p->kernel = kernel;
+    p->rule = rule;
+    const int tile_rows = (b->height + BLOCKING_ROWS - 1) / BLOCKING_ROWS;
+    while (generations) {
+        p->generations = int(std::min<uint64_t>(generations, BLOCKING_GENERATIONS));
+        life_bands_parallel(bands, tile_rows, blocking_run, p);
+        b->current = !b->current;
+        generations -= p->generations;
+    }
+}
+
+#endif // BLOCKING_HPP
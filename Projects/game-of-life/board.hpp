@@ -0,0 +1,158 @@
+#ifndef BOARD_HPP
+#define BOARD_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include "life.hpp"
+#include "bands.hpp"
+
+// Bounded board of any size, chosen at runtime. Cells are packed 64 per
+// word, with a dead guard row above and below the board and a dead guard
+// word on both sides of every row. Rows are padded for the vector kernels.
+//
+// The current and the next generation live in two buffers that swap after
+// every step. Only data words are ever written, guards stay dead in both.
+//
+// On a torus opposite edges are neighbours. Before a step the guards are
+// filled with ghost copies of the cells on the other side, so the kernels
+// wrap around without any modulo, and cleared after it.
+
+struct board_t
+{
+    int width = 0;
+    int height = 0;
+    int words = 0;  // Words of cells in a row
+    int stride = 0; // Words between rows, with padding and guard words
+    std::vector<uint64_t> buffers[2];
+    int current = 0;
+    bool torus = false;
+};
+
+// Reallocates the board for the new size, all cells dead
+inline void board_resize(board_t *b, int width, int height)
+{
+    b->width = width;
+    b->height = height;
+    b->words = life_words(width);
+    b->stride = life_padded_words(width) + 2;
+    for (std::vector<uint64_t> &buffer : b->buffers)
+        buffer.assign(size_t(height + 2) * b->stride, 0);
+    b->current = 0;
+}
+
+// First data word of row y, y = -1 and y = height are the guard rows
+inline uint64_t *board_row(board_t *b, int y, int buffer)
+{
+    return b->buffers[buffer].data() + size_t(y + 1) * b->stride + 1;
+}
+
+inline uint64_t *board_row(board_t *b, int y)
+{
+    return board_row(b, y, b->current);
+}
+
+inline bool board_contains(const board_t *b, int64_t x, int64_t y)
+{
+    return x >= 0 && x < b->width && y >= 0 && y < b->height;
+}
+
+inline bool board_get(board_t *b, int x, int y)
+{
+    return life_get(board_row(b, y), x);
+}
+
+inline void board_set(board_t *b, int x, int y, bool alive)
+{
+    life_set(board_row(b, y), x, alive);
+}
+
+// Sets a run of cells of row y, clipped to the board
+inline void board_set_run(board_t *b, int64_t x, int64_t y, int64_t length)
+{
+    if (y < 0 || y >= b->height)
+        return;
+    const int64_t x0 = std::max<int64_t>(x, 0);
+    const int64_t x1 = std::min<int64_t>(x + length, b->width);
+    if (x0 < x1)
+        life_set_run(board_row(b, y), x0, x1 - x0);
+}
+
+inline void board_clear(board_t *b)
+{
+    std::vector<uint64_t> &cells = b->buffers[b->current];
+    memset(cells.data(), 0, cells.size() * sizeof(uint64_t));
+}
+
+// Ghost cells of a torus in one buffer: the cell before the first one of a
+// row copies the last one and the other way round, then the guard rows copy
+// the last and the first row with their ghosts. Clears them if !fill.
+inline void board_set_ghosts(board_t *b, int buffer, bool fill)
+{
+    for (int y = 0; y < b->height; ++y) {
+        uint64_t *row = board_row(b, y, buffer);
+        // Cell -1 is the top bit of the guard word, cell `width` is the bit
+        // past the last cell: in the last word or the word after it
+        row[-1] = fill && life_get(row, b->width - 1) ? uint64_t(1) << 63 : 0;
+        life_set(row, b->width, fill && life_get(row, 0));
+    }
+    uint64_t *above = board_row(b, -1, buffer) - 1;
+    uint64_t *below = board_row(b, b->height, buffer) - 1;
+    const size_t size = b->stride * sizeof(uint64_t);
+    if (fill) {
+        memcpy(above, board_row(b, b->height - 1, buffer) - 1, size);
+        memcpy(below, board_row(b, 0, buffer) - 1, size);
+    } else {
+        memset(above, 0, size);
+        memset(below, 0, size);
+    }
+}
+
+// Hash of the cells, see life_word_hash()
+inline uint64_t board_hash(board_t *b)
+{
+    uint64_t hash = 0;
+    for (int y = 0; y < b->height; ++y) {
+        const uint64_t *row = board_row(b, y);
+        for (int x = 0; x < b->words; ++x)
+            hash ^= life_word_hash(x, y, row[x]);
+    }
+    return hash;
+}
+
+// Population and bounding box of the cells, no births or deaths
+inline life_stats_t board_stats(board_t *b)
+{
+    life_stats_t stats;
+    life_stats_empty_bounds(stats);
+    for (int y = 0; y < b->height; ++y) {
+        const uint64_t *row = board_row(b, y);
+        for (int x = 0; x < b->words; ++x)
+            stats.population += life_popcount(row[x]);
+        life_stats_add_row(stats, row, b->words, y);
+    }
+    return stats;
+}
+
+// Computes the next generation into the other buffer and swaps. The kernel
+// is life_select_row_kernel() of the rule. If `hash` isn't null, it goes
+// from board_hash() of this generation to that of the next one, and `stats`
+// from board_stats() or the last step to the stats of this one. `dirty`,
+// set up for the board, gets the units that changed.
+inline void board_step(board_t *b, life_bands_t *bands, life_row_kernel kernel, const life_rule_t &rule,
+                       uint64_t *hash = nullptr, life_stats_t *stats = nullptr, life_dirty_t *dirty = nullptr)
+{
+    if (b->torus)
+        board_set_ghosts(b, b->current, true);
+    // Every row is computed a word or a vector of cells at a time from the
+    // rows around it, bands of rows in parallel
+    life_bands_step(bands, kernel, rule, board_row(b, 0, b->current), board_row(b, 0, !b->current),
+                    b->stride, b->height, b->words, life_last_mask(b->width), hash, stats, dirty);
+    if (b->torus)
+        board_set_ghosts(b, b->current, false);
+    b->current = !b->current;
+}
+
+#endif // BOARD_HPP
@@ -0,0 +1,69 @@
+#ifndef CYCLE_HPP
+#define CYCLE_HPP
+
+#include <cstdint>
+#include <vector>
+
+// Detection of still lifes and oscillators: the hash of every generation
+// (see life_word_hash()) goes into a small direct-mapped table of recent
+// ones. A generation with the same hash as one in the table repeats it, and
+// the game is deterministic, so from then on it cycles with the period
+// between the two: 1 for a still life. Hashes are 64-bit, a false match is
+// as good as impossible.
+//
+// Newer generations overwrite older ones in the table, so periods up to
+// about the table size are found.
+
+const int CYCLE_TABLE_SIZE = 1 << 12;
+
+struct cycle_entry_t
+{
+    uint64_t hash;
+    uint64_t generation;
+    bool used;
+};
+
+struct cycle_t
+{
+    // Hash of the current generation, kept up to date by the step while
+    // `valid`. Anything that changes cells other than a step clears it.
+    bool valid = false;
+    uint64_t hash = 0;
+    std::vector<cycle_entry_t> table = std::vector<cycle_entry_t>(CYCLE_TABLE_SIZE);
+    // Found period, 0 until the game cycles
+    uint64_t period = 0;
+};
+
+// Forgets the history, for when cells change other than by a step or the
+// rule changes
+inline void cycle_reset(cycle_t *c)
+{
+    c->valid = false;
+    c->period = 0;
+    for (cycle_entry_t &entry : c->table)
+        entry.used = false;
+}
+
+// Records c->hash as the hash of `generation`. Returns true when this
+// generation finds the period.
+inline bool cycle_add(cycle_t *c, uint64_t generation)
+{
+    if (c->period)
+        return false;
+    cycle_entry_t &entry = c->table[c->hash % CYCLE_TABLE_SIZE];
+    if (entry.used && entry.hash == c->hash && entry.generation < generation) {
+        c->period = generation - entry.generation;
+        return true;
+    }
+    entry = { c->hash, generation, true };
+    return false;
+}
+
+// Steps needed to advance a cycling game by `generations`: only those past
+// the last whole period
+inline uint64_t cycle_steps(const cycle_t *c, uint64_t generations)
+{
+    return c->period ? generations % c->period : generations;
+}
+
+#endif // CYCLE_HPP
@@ -0,0 +1,168 @@
+#ifndef DENSITY_HPP
+#define DENSITY_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "life.hpp"
+#include "bands.hpp"
+
+// Level-of-detail populations of a packed board, for drawing it zoomed out
+// when many cells fall on one pixel. Level k holds the number of live cells
+// in every aligned block of (8 << k) x (8 << k) cells: level 0 is counted
+// from the words, eight blocks per word at once, and every level above sums
+// 2x2 blocks of the one below, up to a single block covering the board.
+//
+// Building reads every word of the board once, about what a step costs.
+// Steps don't build it again: they flag the words they changed in `dirty`
+// (see life_dirty_t) and density_update() counts only those blocks again,
+// then the blocks above them. Drawing a view is then one lookup per pixel,
+// plus work in proportion to the cells that changed since the last one.
+
+const int DENSITY_BLOCK = 8;
+static_assert(DENSITY_BLOCK == LIFE_DIRTY_ROWS, "a unit of changes is a word of a row of level 0 blocks");
+// density_update() builds the pyramid again once more than 1 / this of
+// the words changed
+const int DENSITY_REBUILD = 8;
+
+struct density_t
+{
+    std::vector<std::vector<uint32_t>> levels;
+    std::vector<int64_t> widths;  // In blocks
+    std::vector<int64_t> heights;
+    // Words changed since the last update, for board_step()
+    life_dirty_t dirty;
+    // Blocks of every level above 0 waiting to be summed again, flagged
+    // so that each is listed once
+    std::vector<std::vector<uint8_t>> stale;
+    std::vector<uint64_t> blocks, parents;
+};
+
+// Counts cells [0, width) x [0, height), row(y) returns packed words of row
+// y with nothing set past the width
+template <typename Row>
+void density_build(density_t *d, int64_t width, int64_t height, const Row &row)
+{
+    int64_t w = (width + DENSITY_BLOCK - 1) / DENSITY_BLOCK;
+    int64_t h = (height + DENSITY_BLOCK - 1) / DENSITY_BLOCK;
+    d->levels.resize(1);
+    d->widths.assign(1, w);
+    d->heights.assign(1, h);
+    std::vector<uint32_t> &base = d->levels[0];
+    base.assign(w * h, 0);
+
+    // Byte counts of 8 rows add up to at most 64, still one per byte
+    const int64_t words = (width + 63) / 64;
+    std::vector<uint64_t> sums(words);
+    for (int64_t by = 0; by < h; ++by) {
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int64_t y = by * DENSITY_BLOCK; y < std::min(height, (by + 1) * DENSITY_BLOCK); ++y) {
+            const uint64_t *cells = row(y);
+            for (int64_t x = 0; x < words; ++x)
+                sums[x] += life_byte_counts(cells[x]);
+        }
+        uint32_t *out = &base[by * w];
+        for (int64_t bx = 0; bx < w; ++bx)
+            out[bx] = (sums[bx >> 3] >> ((bx & 7) * 8)) & 0xFF;
+    }
+
+    while (w > 1 || h > 1) {
+        const std::vector<uint32_t> &below = d->levels.back();
+        const int64_t below_w = w, below_h = h;
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+        std::vector<uint32_t> level(w * h);
+        for (int64_t y = 0; y < h; ++y) {
+            // A missing last row or column of the level below counts as 0
+            const uint32_t *top = &below[2 * y * below_w];
+            const uint32_t *bottom = 2 * y + 1 < below_h ? top + below_w : top;
+            const uint32_t bottom_weight = 2 * y + 1 < below_h;
+            uint32_t *out = &level[y * w];
+            for (int64_t x = 0; x < below_w / 2; ++x)
+                out[x] = top[2 * x] + top[2 * x + 1] + bottom_weight * (bottom[2 * x] + bottom[2 * x + 1]);
+            if (below_w % 2)
+                out[w - 1] = top[below_w - 1] + bottom_weight * bottom[below_w - 1];
+        }
+        d->levels.push_back(std::move(level));
+        d->widths.push_back(w);
+        d->heights.push_back(h);
+    }
+
+    life_dirty_reset(&d->dirty, int(words), int(height));
+    d->stale.resize(d->levels.size());
+    for (size_t k = 0; k < d->levels.size(); ++k)
+        d->stale[k].assign(k ? d->levels[k].size() : 0, 0);
+}
+
+// Live cells in block (bx, by) of level k, 0 outside the board. Levels
+// above the top one count like the top one: their only block with cells is
+// (0, 0), which holds the whole board.
+inline uint32_t density_count(const density_t *d, int level, int64_t bx, int64_t by)
+{
+    level = std::min<int>(level, int(d->levels.size()) - 1);
+    if (level < 0 || bx < 0 || by < 0 || bx >= d->widths[level] || by >= d->heights[level])
+        return 0;
+    return d->levels[level][by * d->widths[level] + bx];
+}
+
+// Brings a built pyramid up to date with the changes listed in `dirty` by
+// the steps since, same arguments as density_build(). When most of the
+// board changed, building it again is faster.
+template <typename Row>
+void density_update(density_t *d, int64_t width, int64_t height, const Row &row)
+{
+    life_dirty_t &dirty = d->dirty;
+    size_t changed = 0;
+    for (const std::vector<uint64_t> &list : dirty.lists)
+        changed += list.size();
+    if (changed * DENSITY_REBUILD > dirty.flags.size()) {
+        density_build(d, width, height, row);
+        return;
+    }
+
+    const int64_t w = d->widths[0];
+    const auto mark = [d](int level, int64_t bx, int64_t by) {
+        if (level >= int(d->levels.size()) || bx >= d->widths[level])
+            return;
+        uint8_t &flag = d->stale[level][by * d->widths[level] + bx];
+        if (!flag)
+            d->blocks.push_back(uint64_t(by * d->widths[level] + bx));
+        flag = 1;
+    };
+
+    // Level 0 blocks of a unit are counted again from its eight words
+    d->blocks.clear();
+    for (std::vector<uint64_t> &list : dirty.lists) {
+        for (uint64_t unit : list) {
+            dirty.flags[unit] = 0;
+            const int64_t by = int64_t(unit) / dirty.columns, x = int64_t(unit) % dirty.columns;
+            uint64_t sums = 0;
+            for (int64_t y = by * DENSITY_BLOCK; y < std::min(height, (by + 1) * DENSITY_BLOCK); ++y)
+                sums += life_byte_counts(row(y)[x]);
+            uint32_t *out = &d->levels[0][by * w];
+            for (int64_t bx = x * 8; bx < std::min(w, x * 8 + 8); ++bx)
+                out[bx] = (sums >> ((bx & 7) * 8)) & 0xFF;
+            for (int64_t bx = x * 4; bx < x * 4 + 4; ++bx)
+                mark(1, bx, by / 2);
+        }
+        list.clear();
+    }
+
+    // Then every level from the one below, only the blocks above changes
+    for (int level = 1; level < int(d->levels.size()); ++level) {
+        d->parents.clear();
+        d->blocks.swap(d->parents);
+        const int64_t level_w = d->widths[level];
+        for (uint64_t block : d->parents) {
+            const int64_t bx = int64_t(block) % level_w, by = int64_t(block) / level_w;
+            d->stale[level][block] = 0;
+            d->levels[level][block] = density_count(d, level - 1, 2 * bx, 2 * by) +
+                                      density_count(d, level - 1, 2 * bx + 1, 2 * by) +
+                                      density_count(d, level - 1, 2 * bx, 2 * by + 1) +
+                                      density_count(d, level - 1, 2 * bx + 1, 2 * by + 1);
+            mark(level + 1, bx / 2, by / 2);
+        }
+    }
+}
+
+#endif // DENSITY_HPP
@@ -0,0 +1,255 @@
+#ifndef DOMAIN_HPP
+#define DOMAIN_HPP
+
+// Domain decomposition of a board over processes, for boards too big for
+// one: the rows are split into strips, one per process, and every process
+// steps only its own strip in its own memory. The one row above and below a
+// strip (the halo) belongs to the neighbours, who publish their first and
+// last rows in POSIX shared memory after every generation.
+//
+// A generation is a single synchronization: publish the edge rows, wait at
+// a barrier shared by the processes, read the neighbours' edges into the
+// guard rows, step. Edges alternate between two sets of slots by the parity
+// of the generation, so a process that runs ahead writes the next ones
+// while slower neighbours still read the last ones, and can't get further
+// than that without passing the next barrier.
+//
+// The processes are forked from the caller and share nothing else, so the
+// same strips could run on several machines with the edges sent over
+// sockets instead; only the local transport exists so far. The whole board
+// goes through shared memory too, once before the first generation and
+// once after the last.
+
+#if defined(__unix__) || defined(__APPLE__)
+#define DOMAIN_SUPPORTED 1
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "life.hpp"
+#include "bands.hpp"
+#include "board.hpp"
+
+// Barrier of the processes, life_barrier_t in shared memory: pthread
+// barriers are missing on some systems, process-shared mutexes and
+// condition variables aren't
+struct domain_header_t
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+    int waiting;
+    uint64_t phase;
+};
+
+struct domain_t
+{
+    int processes = 0;
+    int width = 0;
+    int height = 0;
+    int words = 0;
+    void *memory = nullptr;
+    size_t size = 0;
+    domain_header_t *header = nullptr;
+    // Edge rows, [parity][process][first, last], `words` words each
+    uint64_t *edges = nullptr;
+    // The whole board, `words` words per row, between runs
+    uint64_t *cells = nullptr;
+};
+
+// Maps shared memory for a width x height board split between `processes`,
+// at most one per row. Returns false if the system refuses.
+inline bool domain_create(domain_t *d, int processes, int width, int height)
+{
+    d->processes = std::max(std::min(processes, height), 1);
+    d->width = width;
+    d->height = height;
+    d->words = life_words(width);
+    const size_t header = (sizeof(domain_header_t) + 63) / 64 * 64;
+    const size_t edges = size_t(2) * d->processes * 2 * d->words;
+    d->size = header + (edges + size_t(height) * d->words) * sizeof(uint64_t);
+
+    // The name is only needed until the processes are forked
+    char name[64];
+    snprintf(name, sizeof(name), "/game-of-life-%d", int(getpid()));
+    const int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+        return false;
+    shm_unlink(name);
+    const bool sized = ftruncate(fd, off_t(d->size)) == 0;
+    d->memory = sized ? mmap(nullptr, d->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (d->memory == MAP_FAILED) {
+        d->memory = nullptr;
+        return false;
+    }
+
+    d->header = (domain_header_t *) d->memory;
+    d->edges = (uint64_t *) ((char *) d->memory + header);
+    d->cells = d->edges + edges;
+    d->header->waiting = 0;
+    d->header->phase = 0;
+    pthread_mutexattr_t lock_attributes;
+    pthread_condattr_t cv_attributes;
+    pthread_mutexattr_init(&lock_attributes);
+    pthread_condattr_init(&cv_attributes);
+    bool shared = pthread_mutexattr_setpshared(&lock_attributes, PTHREAD_PROCESS_SHARED) == 0 &&
+                  pthread_condattr_setpshared(&cv_attributes, PTHREAD_PROCESS_SHARED) == 0 &&
+                  pthread_mutex_init(&d->header->lock, &lock_attributes) == 0;
+    if (shared && pthread_cond_init(&d->header->cv, &cv_attributes) != 0) {
+        pthread_mutex_destroy(&d->header->lock);
+        shared = false;
+    }
+    pthread_mutexattr_destroy(&lock_attributes);
+    pthread_condattr_destroy(&cv_attributes);
+    if (!shared) {
+        munmap(d->memory, d->size);
+        d->memory = nullptr;
+        return false;
+    }
+    return true;
+}
+
+inline void domain_destroy(domain_t *d)
+{
+    if (!d->memory)
+        return;
+    pthread_cond_destroy(&d->header->cv);
+    pthread_mutex_destroy(&d->header->lock);
+    munmap(d->memory, d->size);
+    d->memory = nullptr;
+}
+
+// Blocks until all processes have arrived, then releases all of them
+inline void domain_barrier_wait(domain_t *d)
+{
+    domain_header_t *b = d->header;
+    pthread_mutex_lock(&b->lock);
+    const uint64_t phase = b->phase;
+    if (++b->waiting == d->processes) {
+        b->waiting = 0;
+        b->phase++;
+        pthread_cond_broadcast(&b->cv);
+    } else {
+        while (b->phase == phase)
+            pthread_cond_wait(&b->cv, &b->lock);
+    }
+    pthread_mutex_unlock(&b->lock);
+}
+
+inline uint64_t *domain_row(domain_t *d, int y)
+{
+    return d->cells + size_t(y) * d->words;
+}
+
+// Edge row of a process for a generation, the first row of its strip or
+// the last one
+inline uint64_t *domain_edge(domain_t *d, uint64_t generation, int process, bool last)
+{
+    return d->edges + ((size_t(generation & 1) * d->processes + process) * 2 + last) * d->words;
+}
+
+// Rows [y0, y1) of the strip of process i
+inline void domain_strip(const domain_t *d, int i, int &y0, int &y1)
+{
+    y0 = int(int64_t(d->height) * i / d->processes);
+    y1 = int(int64_t(d->height) * (i + 1) / d->processes);
+}
+
+// Body of process i: steps its strip `generations` generations, trading
+// edges with its neighbours, and puts it back into the shared board
+inline void domain_work(domain_t *d, int i, life_row_kernel kernel, const life_rule_t &rule, uint64_t generations)
+{
+    int y0, y1;
+    domain_strip(d, i, y0, y1);
+    const size_t row_size = d->words * sizeof(uint64_t);
+    board_t strip;
+    board_resize(&strip, d->width, y1 - y0);
+    for (int y = y0; y < y1; ++y)
+        memcpy(board_row(&strip, y - y0), domain_row(d, y), row_size);
+    life_bands_t bands;
+    life_bands_init(&bands, 1);
+
+    for (uint64_t g = 0; g < generations; ++g) {
+        memcpy(domain_edge(d, g, i, false), board_row(&strip, 0), row_size);
+        memcpy(domain_edge(d, g, i, true), board_row(&strip, strip.height - 1), row_size);
+        domain_barrier_wait(d);
+        // Halo rows go where the guard rows are, outside the board they
+        // stay dead
+        if (i > 0)
+            memcpy(board_row(&strip, -1), domain_edge(d, g, i - 1, true), row_size);
+        if (i < d->processes - 1)
+            memcpy(board_row(&strip, strip.height), domain_edge(d, g, i + 1, false), row_size);
+        life_bands_step(&bands, kernel, rule, board_row(&strip, 0), board_row(&strip, 0, !strip.current),
+                        strip.stride, strip.height, strip.words, life_last_mask(strip.width));
+        strip.current = !strip.current;
+    }
+
+    life_bands_destroy(&bands);
+    for (int y = y0; y < y1; ++y)
+        memcpy(domain_row(d, y), board_row(&strip, y - y0), row_size);
+}
+
+// Advances the shared board by `generations` with a forked process per
+// strip. The caller must have no other threads running. Returns false if a
+// process couldn't start or failed, the board is lost then.
+inline bool domain_advance(domain_t *d, life_row_kernel kernel, const life_rule_t &rule, uint64_t generations)
+{
+    // The processes go into a group of their own, the first one's, so that
+    // waiting reaps them in the order they finish and nothing else. Both
+    // sides set it, whichever runs first.
+    std::vector<pid_t> children;
+    pid_t group = 0;
+    bool ok = true;
+    for (int i = 0; i < d->processes && ok; ++i) {
+        const pid_t pid = fork();
+        if (pid == 0) {
+            setpgid(0, group);
+            domain_work(d, i, kernel, rule, generations);
+            _exit(0);
+        }
+        if (pid < 0) {
+            ok = false;
+        } else {
+            setpgid(pid, group);
+            if (!group)
+                group = pid;
+            children.push_back(pid);
+        }
+    }
+
+    // Without all of them the others would wait at the barrier forever
+    if (!ok)
+        for (pid_t pid : children)
+            kill(pid, SIGKILL);
+    for (size_t left = children.size(); left > 0; --left) {
+        int status;
+        pid_t pid;
+        do {
+            pid = waitpid(-group, &status, 0);
+        } while (pid < 0 && errno == EINTR);
+        if (pid < 0)
+            return false;
+        if (ok && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+            ok = false;
+            for (pid_t other : children)
+                if (other != pid)
+                    kill(other, SIGKILL);
+        }
+    }
+    return ok;
+}
+
+#else
+#define DOMAIN_SUPPORTED 0
+#endif
+
+#endif // DOMAIN_HPP
@@ -0,0 +1,528 @@
+#ifndef HASHLIFE_HPP
+#define HASHLIFE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "rule.hpp"
+
+// Hashlife: the universe is a quadtree of canonical (hash-consed) nodes, so
+// every distinct square pattern is stored once. Each node of level k covers
+// 2^k x 2^k cells and memoizes its RESULT: the centered 2^(k-1) square
+// advanced by 2^min(k-2, step_log) generations. Repetitive patterns reuse
+// results, so the number of generations per step grows exponentially.
+//
+// The universe is unbounded. Nodes are referred to by index, level 0 nodes
+// 0 and 1 are the dead and the alive cell.
+
+const uint32_t HASHLIFE_NONE = UINT32_MAX;
+// Largest single step, keeps the root small enough for 64-bit coordinates
+const int HASHLIFE_MAX_STEP_LOG = 56;
+
+struct hashlife_node_t
+{
+    uint32_t nw, ne, sw, se;
+    uint32_t result;
+    uint32_t next; // Next node in the same hash bucket or in the free list
+    uint64_t population;
+    uint8_t level;
+    bool mark;
+};
+
+struct hashlife_t
+{
+    std::vector<hashlife_node_t> nodes;
+    std::vector<uint32_t> buckets;
+    std::vector<uint32_t> empty; // Canonical empty node of every level
+    uint32_t free_list;
+    size_t live_nodes;
+    // Node count above which hashlife_advance() collects garbage
+    size_t max_nodes;
+    // Node count above which hashlife_step() collects in the middle of a
+    // step: max_nodes, or twice what the last collection kept when the step
+    // itself needs more, so that it doesn't collect on every call
+    size_t collect_at;
+    // Nodes the hashlife_step() calls in progress still need, roots for a
+    // collection
+    std::vector<uint32_t> pinned;
+    // Results stored in nodes are for steps of 2^step_log generations
+    int step_log;
+
+    uint32_t root;
+    // Universe coordinates of the top-left cell of the root
+    int64_t origin_x, origin_y;
+    uint64_t generation;
+
+    // Next state of the center 2x2 of every 4x4 block under the rule, bit
+    // y * 4 + x of the index is cell (x, y), bit y * 2 + x of the value is
+    // result (x, y)
+    life_rule_t rule;
+    std::vector<uint8_t> table;
+};
+
+inline uint64_t hashlife_hash(uint32_t nw, uint32_t ne, uint32_t sw, uint32_t se)
+{
+    uint64_t h = nw;
+    h = h * 0x9E3779B97F4A7C15ull + ne;
+    h = h * 0x9E3779B97F4A7C15ull + sw;
+    h = h * 0x9E3779B97F4A7C15ull + se;
+    return h ^ (h >> 29);
+}
+
+inline void hashlife_rehash(hashlife_t *h, size_t buckets)
+{
+    h->buckets.assign(buckets, HASHLIFE_NONE);
+    for (uint32_t i = 2; i < h->nodes.size(); ++i) {
+        hashlife_node_t &node = h->nodes[i];
+        if (node.level == 0) // Freed
+            continue;
+        uint32_t &head = h->buckets[hashlife_hash(node.nw, node.ne, node.sw, node.se) & (buckets - 1)];
+        node.next = head;
+        head = i;
+    }
+}
+
+// Returns the canonical node with the given children, creating it if needed
+inline uint32_t hashlife_join(hashlife_t *h, uint32_t nw, uint32_t ne, uint32_t sw, uint32_t se)
+{
+    const size_t mask = h->buckets.size() - 1;
+    const uint64_t hash = hashlife_hash(nw, ne, sw, se);
+    for (uint32_t i = h->buckets[hash & mask]; i != HASHLIFE_NONE; i = h->nodes[i].next) {
+        const hashlife_node_t &node = h->nodes[i];
+        if (node.nw == nw && node.ne == ne && node.sw == sw && node.se == se)
+            return i;
+    }
+
+    hashlife_node_t node = {
+        nw, ne, sw, se,
+        HASHLIFE_NONE, // result
+        HASHLIFE_NONE, // next
+        h->nodes[nw].population + h->nodes[ne].population +
+            h->nodes[sw].population + h->nodes[se].population,
+        uint8_t(h->nodes[nw].level + 1),
+        false, // mark
+    };
+    uint32_t index;
+    if (h->free_list != HASHLIFE_NONE) {
+        index = h->free_list;
+        h->free_list = h->nodes[index].next;
+        h->nodes[index] = node;
+    } else {
+        index = h->nodes.size();
+        h->nodes.push_back(node);
+    }
+    h->live_nodes++;
+
+    if (h->live_nodes > h->buckets.size()) {
+        hashlife_rehash(h, h->buckets.size() * 2);
+    } else {
+        uint32_t &head = h->buckets[hash & mask];
+        h->nodes[index].next = head;
+        head = index;
+    }
+    return index;
+}
+
+inline uint32_t hashlife_empty(hashlife_t *h, int level)
+{
+    while ((int) h->empty.size() <= level) {
+        uint32_t e = h->empty.back();
+        h->empty.push_back(hashlife_join(h, e, e, e, e));
+    }
+    return h->empty[level];
+}
+
+// Memoized results hold for one rule only, so changing it drops them
+inline void hashlife_set_rule(hashlife_t *h, const life_rule_t &rule)
+{
+    if (h->rule == rule)
+        return;
+    h->rule = rule;
+    for (auto &node : h->nodes)
+        node.result = HASHLIFE_NONE;
+
+    for (int bits = 0; bits < (1 << 16); ++bits) {
+        uint8_t result = 0;
+        for (int y = 1; y <= 2; ++y) {
+            for (int x = 1; x <= 2; ++x) {
+                int alive = 0;
+                for (int i = 0; i < 9; ++i) {
+                    int nx = x - 1 + i % 3;
+                    int ny = y - 1 + i / 3;
+                    if (nx != x || ny != y)
+                        alive += (bits >> (ny * 4 + nx)) & 1;
+                }
+                bool center = (bits >> (y * 4 + x)) & 1;
+                if (((center ? rule.survive : rule.birth) >> alive) & 1)
+                    result |= 1 << ((y - 1) * 2 + (x - 1));
+            }
+        }
+        h->table[bits] = result;
+    }
+}
+
+inline void hashlife_init(hashlife_t *h, size_t max_bytes)
+{
+    h->nodes.clear();
+    // Leaves: no children, level 0
+    h->nodes.push_back({ HASHLIFE_NONE, HASHLIFE_NONE, HASHLIFE_NONE, HASHLIFE_NONE,
+                         HASHLIFE_NONE, HASHLIFE_NONE, 0, 0, false });
+    h->nodes.push_back({ HASHLIFE_NONE, HASHLIFE_NONE, HASHLIFE_NONE, HASHLIFE_NONE,
+                         HASHLIFE_NONE, HASHLIFE_NONE, 1, 0, false });
+    h->buckets.assign(1 << 16, HASHLIFE_NONE);
+    h->free_list = HASHLIFE_NONE;
+    h->live_nodes = 0;
+    h->max_nodes = max_bytes / (sizeof(hashlife_node_t) + sizeof(uint32_t));
+    h->collect_at = h->max_nodes;
+    h->pinned.clear();
+    h->step_log = 0;
+    h->empty.assign(1, 0);
+    h->root = hashlife_empty(h, 3);
+    h->origin_x = h->origin_y = -4;
+    h->generation = 0;
+
+    h->table.resize(1 << 16);
+    h->rule = { 0, 0 };
+    hashlife_set_rule(h, LIFE_CONWAY);
+}
+
+// Centered node one level below: the inner quarters of the four children
+inline uint32_t hashlife_center(hashlife_t *h, uint32_t n)
+{
+    const hashlife_node_t node = h->nodes[n];
+    return hashlife_join(h, h->nodes[node.nw].se, h->nodes[node.ne].sw,
+                         h->nodes[node.sw].ne, h->nodes[node.se].nw);
+}
+
+// Node of the same level as w and e, centered between them horizontally
+inline uint32_t hashlife_horizontal(hashlife_t *h, uint32_t w, uint32_t e)
+{
+    const hashlife_node_t west = h->nodes[w], east = h->nodes[e];
+    return hashlife_join(h, west.ne, east.nw, west.se, east.sw);
+}
+
+inline uint32_t hashlife_vertical(hashlife_t *h, uint32_t n, uint32_t s)
+{
+    const hashlife_node_t north = h->nodes[n], south = h->nodes[s];
+    return hashlife_join(h, north.sw, north.se, south.nw, south.ne);
+}
+
+// 4x4 node: one generation of its center by table lookup
+inline uint32_t hashlife_step_leaf(hashlife_t *h, uint32_t n)
+{
+    const hashlife_node_t node = h->nodes[n];
+    int bits = 0;
+    const uint32_t quads[4] = { node.nw, node.ne, node.sw, node.se };
+    for (int q = 0; q < 4; ++q) {
+        const hashlife_node_t quad = h->nodes[quads[q]];
+        const int x = (q % 2) * 2, y = (q / 2) * 2;
+        bits |= int(quad.nw) << (y * 4 + x);
+        bits |= int(quad.ne) << (y * 4 + x + 1);
+        bits |= int(quad.sw) << ((y + 1) * 4 + x);
+        bits |= int(quad.se) << ((y + 1) * 4 + x + 1);
+    }
+    const int r = h->table[bits];
+    return hashlife_join(h, r & 1, (r >> 1) & 1, (r >> 2) & 1, (r >> 3) & 1);
+}
+
+inline void hashlife_collect(hashlife_t *h);
+
+// RESULT of node n of level k >= 2: its center advanced by
+// 2^min(k - 2, step_log) generations. n must be the root or pinned.
+inline uint32_t hashlife_step(hashlife_t *h, uint32_t n)
+{
+    if (h->nodes[n].result != HASHLIFE_NONE)
+        return h->nodes[n].result;
+    // A single large step can create far more than max_nodes nodes
+    if (h->live_nodes > h->collect_at)
+        hashlife_collect(h);
+
+    const int level = h->nodes[n].level;
+    uint32_t result;
+    if (h->nodes[n].population == 0) {
+        result = hashlife_empty(h, level - 1);
+    } else if (level == 2) {
+        result = hashlife_step_leaf(h, n);
+    } else {
+        const hashlife_node_t node = h->nodes[n];
+        // Nine overlapping subnodes of level k - 1, each advanced by
+        // 2^min(k - 3, step_log). They wait on the pinned stack rather than
+        // in locals, a collection in a deeper call would free them there.
+        const uint32_t sub[9] = {
+            node.nw, hashlife_horizontal(h, node.nw, node.ne), node.ne,
+            hashlife_vertical(h, node.nw, node.sw), hashlife_center(h, n), hashlife_vertical(h, node.ne, node.se),
+            node.sw, hashlife_horizontal(h, node.sw, node.se), node.se,
+        };
+        const size_t frame = h->pinned.size();
+        h->pinned.insert(h->pinned.end(), sub, sub + 9);
+        for (int i = 0; i < 9; ++i) {
+            const uint32_t stepped = hashlife_step(h, h->pinned[frame + i]);
+            h->pinned[frame + i] = stepped;
+        }
+
+        uint32_t quads[4];
+        for (int q = 0; q < 4; ++q) {
+            const uint32_t *s = &h->pinned[frame + (q / 2) * 3 + q % 2];
+            quads[q] = hashlife_join(h, s[0], s[1], s[3], s[4]);
+        }
+        h->pinned.resize(frame);
+        h->pinned.insert(h->pinned.end(), quads, quads + 4);
+        // At full speed the second half of the generations comes from
+        // stepping again, for smaller steps the centers are taken as is
+        const bool full_speed = level - 2 <= h->step_log;
+        for (int q = 0; q < 4; ++q) {
+            const uint32_t quad = h->pinned[frame + q];
+            const uint32_t stepped = full_speed ? hashlife_step(h, quad) : hashlife_center(h, quad);
+            h->pinned[frame + q] = stepped;
+        }
+        const uint32_t *s = &h->pinned[frame];
+        result = hashlife_join(h, s[0], s[1], s[2], s[3]);
+        h->pinned.resize(frame);
+    }
+    h->nodes[n].result = result;
+    return result;
+}
+
+// Wraps the root into a node twice as large, keeping it centered
+inline void hashlife_expand(hashlife_t *h)
+{
+    const hashlife_node_t root = h->nodes[h->root];
+    const uint32_t e = hashlife_empty(h, root.level - 1);
+    const uint32_t nw = hashlife_join(h, e, e, e, root.nw);
+    const uint32_t ne = hashlife_join(h, e, e, root.ne, e);
+    const uint32_t sw = hashlife_join(h, e, root.sw, e, e);
+    const uint32_t se = hashlife_join(h, root.se, e, e, e);
+    h->root = hashlife_join(h, nw, ne, sw, se);
+    const int64_t quarter = int64_t(1) << (root.level - 1);
+    h->origin_x -= quarter;
+    h->origin_y -= quarter;
+}
+
+inline void hashlife_mark(hashlife_t *h, uint32_t n)
+{
+    // Leaves and already visited subtrees
+    if (n < 2 || h->nodes[n].mark)
+        return;
+    h->nodes[n].mark = true;
+    hashlife_mark(h, h->nodes[n].nw);
+    hashlife_mark(h, h->nodes[n].ne);
+    hashlife_mark(h, h->nodes[n].sw);
+    hashlife_mark(h, h->nodes[n].se);
+}
+
+// Frees every node unreachable from the root, the empty nodes and the
+// pinned ones. Cached results survive only if they point to a reachable node.
+inline void hashlife_collect(hashlife_t *h)
+{
+    hashlife_mark(h, h->root);
+    for (uint32_t e : h->empty)
+        hashlife_mark(h, e);
+    for (uint32_t p : h->pinned)
+        hashlife_mark(h, p);
+
+    h->free_list = HASHLIFE_NONE;
+    h->live_nodes = 0;
+    for (uint32_t i = h->nodes.size() - 1; i >= 2; --i) {
+        hashlife_node_t &node = h->nodes[i];
+        if (node.mark) {
+            node.mark = false;
+            h->live_nodes++;
+        } else {
+            node.level = 0; // Marks the slot as free for hashlife_rehash()
+            node.next = h->free_list;
+            h->free_list = i;
+        }
+    }
+    for (uint32_t i = 2; i < h->nodes.size(); ++i) {
+        hashlife_node_t &node = h->nodes[i];
+        if (node.level != 0 && node.result != HASHLIFE_NONE && node.result >= 2 && h->nodes[node.result].level == 0)
+            node.result = HASHLIFE_NONE;
+    }
+    hashlife_rehash(h, h->buckets.size());
+    h->collect_at = std::max(h->max_nodes, 2 * h->live_nodes);
+}
+
+inline void hashlife_set_step_log(hashlife_t *h, int step_log)
+{
+    if (h->step_log == step_log)
+        return;
+    h->step_log = step_log;
+    for (auto &node : h->nodes)
+        node.result = HASHLIFE_NONE;
+}
+
+// Advances the universe by 2^step_log generations
+inline void hashlife_advance_pow2(hashlife_t *h, int step_log)
+{
+    hashlife_set_step_log(h, step_log);
+    // The pattern must sit in the central quarter of a root at least
+    // step_log + 3 levels high: it can't grow past the RESULT square then
+    while (h->nodes[h->root].level < step_log + 3 ||
+           h->nodes[hashlife_center(h, hashlife_center(h, h->root))].population != h->nodes[h->root].population)
+        hashlife_expand(h);
+
+    const int level = h->nodes[h->root].level;
+    h->root = hashlife_step(h, h->root);
+    const int64_t quarter = int64_t(1) << (level - 2);
+    h->origin_x += quarter;
+    h->origin_y += quarter;
+    h->generation += uint64_t(1) << step_log;
+
+    if (h->live_nodes > h->max_nodes)
+        hashlife_collect(h);
+}
+
+// Advances the universe by any number of generations, one power of two at
+// a time, largest first
+inline void hashlife_advance(hashlife_t *h, uint64_t generations)
+{
+    for (int bit = 63; bit >= 0; --bit) {
+        if (!((generations >> bit) & 1))
+            continue;
+        if (bit <= HASHLIFE_MAX_STEP_LOG) {
+            hashlife_advance_pow2(h, bit);
+            continue;
+        }
+        for (uint64_t i = 0; i < (uint64_t(1) << (bit - HASHLIFE_MAX_STEP_LOG)); ++i)
+            hashlife_advance_pow2(h, HASHLIFE_MAX_STEP_LOG);
+    }
+}
+
+// Universes are loaded from squares of 64 x 64 cells, the chunks of a
+// sparse universe or 64 rows of a word column of a board: one level 6 node
+// each, and only for squares with live cells. The levels above come from
+// where the squares are, so loading costs as much as the cells it loads,
+// however far apart they are.
+const int HASHLIFE_BLOCK_LEVEL = 6;
+
+struct hashlife_block_t
+{
+    int64_t x, y; // Top-left cell (64 * x, 64 * y)
+    uint32_t node;
+};
+
+// Node of cells [x, x + 2^level) x [y, y + 2^level) of 64 rows, bit x of
+// rows[y] is cell (x, y)
+inline uint32_t hashlife_build_rows(hashlife_t *h, const uint64_t *rows, int level, int x, int y)
+{
+    const int size = 1 << level;
+    const uint64_t mask = (size == 64 ? ~uint64_t(0) : (uint64_t(1) << size) - 1) << x;
+    uint64_t any = 0;
+    for (int i = 0; i < size; ++i)
+        any |= rows[y + i] & mask;
+    if (!any)
+        return hashlife_empty(h, level);
+    if (level == 0)
+        return 1;
+    const int half = size / 2;
+    const uint32_t nw = hashlife_build_rows(h, rows, level - 1, x, y);
+    const uint32_t ne = hashlife_build_rows(h, rows, level - 1, x + half, y);
+    const uint32_t sw = hashlife_build_rows(h, rows, level - 1, x, y + half);
+    const uint32_t se = hashlife_build_rows(h, rows, level - 1, x + half, y + half);
+    return hashlife_join(h, nw, ne, sw, se);
+}
+
+// Level 6 node of 64 rows of 64 cells
+inline uint32_t hashlife_block(hashlife_t *h, const uint64_t *rows)
+{
+    return hashlife_build_rows(h, rows, HASHLIFE_BLOCK_LEVEL, 0, 0);
+}
+
+// Node of `level` with top-left block (x, y) from the blocks inside it,
+// which it reorders
+inline uint32_t hashlife_build_blocks(hashlife_t *h, int level, int64_t x, int64_t y,
+                                      hashlife_block_t *first, hashlife_block_t *last)
+{
+    if (first == last)
+        return hashlife_empty(h, level);
+    if (level == HASHLIFE_BLOCK_LEVEL)
+        return first->node;
+    const int64_t half = int64_t(1) << (level - HASHLIFE_BLOCK_LEVEL - 1);
+    hashlife_block_t *south = std::partition(first, last, [&](const hashlife_block_t &b) { return b.y < y + half; });
+    hashlife_block_t *north_east = std::partition(first, south, [&](const hashlife_block_t &b) { return b.x < x + half; });
+    hashlife_block_t *south_east = std::partition(south, last, [&](const hashlife_block_t &b) { return b.x < x + half; });
+    const uint32_t nw = hashlife_build_blocks(h, level - 1, x, y, first, north_east);
+    const uint32_t ne = hashlife_build_blocks(h, level - 1, x + half, y, north_east, south);
+    const uint32_t sw = hashlife_build_blocks(h, level - 1, x, y + half, south, south_east);
+    const uint32_t se = hashlife_build_blocks(h, level - 1, x + half, y + half, south_east, last);
+    return hashlife_join(h, nw, ne, sw, se);
+}
+
+// Replaces the universe with blocks from hashlife_block(), in any order and
+// none twice
+inline void hashlife_load(hashlife_t *h, std::vector<hashlife_block_t> &blocks)
+{
+    int64_t x0 = 0, y0 = 0, x1 = 1, y1 = 1;
+    if (!blocks.empty()) {
+        x0 = x1 = blocks[0].x;
+        y0 = y1 = blocks[0].y;
+        for (const hashlife_block_t &b : blocks) {
+            x0 = std::min(x0, b.x);
+            y0 = std::min(y0, b.y);
+            x1 = std::max(x1, b.x);
+            y1 = std::max(y1, b.y);
+        }
+        x1++;
+        y1++;
+    }
+    int level = HASHLIFE_BLOCK_LEVEL;
+    while ((int64_t(1) << (level - HASHLIFE_BLOCK_LEVEL)) < std::max(x1 - x0, y1 - y0))
+        level++;
+    h->root = hashlife_build_blocks(h, level, x0, y0, blocks.data(), blocks.data() + blocks.size());
+    h->origin_x = x0 * 64;
+    h->origin_y = y0 * 64;
+    h->generation = 0;
+}
+
+// Replaces the universe with cells (0, 0) to (width, height), row(y) returns
+// the packed words of row y with nothing set past the width. Dead words
+// cost a read each, nothing more.
+template <typename Row>
+void hashlife_load_rows(hashlife_t *h, int64_t width, int64_t height, const Row &row)
+{
+    std::vector<hashlife_block_t> blocks;
+    uint64_t rows[64];
+    const int64_t words = (width + 63) / 64;
+    for (int64_t by = 0; by * 64 < height; ++by) {
+        for (int64_t x = 0; x < words; ++x) {
+            uint64_t any = 0;
+            for (int64_t i = 0; i < 64; ++i) {
+                rows[i] = by * 64 + i < height ? row(by * 64 + i)[x] : 0;
+                any |= rows[i];
+            }
+            if (any)
+                blocks.push_back({ x, by, hashlife_block(h, rows) });
+        }
+    }
+    hashlife_load(h, blocks);
+}
+
+// Calls alive(x, y) for every live cell of node n (top-left cell at x, y)
+// inside [x0, x1) x [y0, y1). Empty and clipped subtrees are skipped whole.
+template <typename Alive>
+void hashlife_for_each(hashlife_t *h, uint32_t n, int64_t x, int64_t y,
+                       int64_t x0, int64_t y0, int64_t x1, int64_t y1, const Alive &alive)
+{
+    const hashlife_node_t node = h->nodes[n];
+    const int64_t size = int64_t(1) << node.level;
+    if (node.population == 0 || x >= x1 || y >= y1 || x + size <= x0 || y + size <= y0)
+        return;
+    if (node.level == 0) {
+        alive(x, y);
+        return;
+    }
+    const int64_t half = size / 2;
+    hashlife_for_each(h, node.nw, x, y, x0, y0, x1, y1, alive);
+    hashlife_for_each(h, node.ne, x + half, y, x0, y0, x1, y1, alive);
+    hashlife_for_each(h, node.sw, x, y + half, x0, y0, x1, y1, alive);
+    hashlife_for_each(h, node.se, x + half, y + half, x0, y0, x1, y1, alive);
+}
+
+template <typename Alive>
+void hashlife_for_each(hashlife_t *h, int64_t x0, int64_t y0, int64_t x1, int64_t y1, const Alive &alive)
+{
+    hashlife_for_each(h, h->root, h->origin_x, h->origin_y, x0, y0, x1, y1, alive);
+}
+
+#endif // HASHLIFE_HPP
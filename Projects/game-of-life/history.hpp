@@ -0,0 +1,179 @@
+#ifndef HISTORY_HPP
+#define HISTORY_HPP
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "board.hpp"
+
+// Rewind history of a board: the last generations it went through, to step
+// back to any of them. Every generation is either a keyframe, a copy of the
+// whole buffer, or a delta: the offsets and the XOR of the words that
+// changed since the generation before. XOR works both ways, so a delta
+// takes the board one generation forward or back.
+//
+// A new keyframe starts once the deltas since the last one add up to as many
+// words as a keyframe, so going to any generation costs at most about two
+// copies of the board: undo the deltas after it from the current cells, or
+// redo those before it on a copy of the keyframe before it. Patterns that
+// change little keep long runs of small deltas, chaotic ones keyframes.
+//
+// Memory stays under a limit, give or take the generations since the last
+// keyframe and two buffers of scratch: past it, the oldest keyframe goes with
+// its deltas. A board bigger than the limit has no history at all.
+
+struct history_entry_t
+{
+    uint64_t generation;
+    bool keyframe;
+    // All words of the buffer for a keyframe, pairs of an offset into the
+    // buffer and the changed bits of that word otherwise
+    std::vector<uint64_t> words;
+};
+
+struct history_t
+{
+    // Consecutive generations, the first one a keyframe and the last one
+    // the current cells of the board
+    std::deque<history_entry_t> entries;
+    size_t words = 0;        // In all entries
+    size_t delta_words = 0;  // Since the last keyframe
+    size_t limit = 0;        // In bytes
+    // Deltas are found here before they are copied to an entry of their
+    // size, and a dropped keyframe is kept for the next one, so that
+    // neither faults its pages in again every generation
+    std::vector<uint64_t> scratch;
+    std::vector<uint64_t> spare;
+};
+
+inline void history_init(history_t *h, size_t limit)
+{
+    h->limit = limit;
+}
+
+// Forgets all generations, for when cells change other than by a step
+inline void history_clear(history_t *h)
+{
+    h->entries.clear();
+    h->words = 0;
+    h->delta_words = 0;
+}
+
+// Oldest generation the board can go back to, if there is any history
+inline uint64_t history_oldest(const history_t *h)
+{
+    return h->entries.empty() ? 0 : h->entries.front().generation;
+}
+
+// Records the current cells of the board as `generation`, after the step
+// from `generation` - 1 if that was the last one recorded: the other buffer
+// still holds it then. Anything else starts a new history. Recording the
+// last generation again does nothing, so it can be done before every step.
+inline void history_record(history_t *h, board_t *b, uint64_t generation)
+{
+    const std::vector<uint64_t> &cells = b->buffers[b->current];
+    if (cells.size() * sizeof(uint64_t) > h->limit) {
+        history_clear(h);
+        return;
+    }
+    if (!h->entries.empty() && h->entries.back().generation == generation)
+        return;
+    const bool follows = !h->entries.empty() && h->entries.back().generation + 1 == generation;
+    if (!follows)
+        history_clear(h);
+
+    history_entry_t entry = { generation, true, {} };
+    if (follows && h->delta_words < cells.size()) {
+        // Without a branch per word: every word is written, only changed
+        // ones are kept. A delta is never bigger than a keyframe, half the
+        // words changed make it one.
+        const std::vector<uint64_t> &before = b->buffers[!b->current];
+        h->scratch.resize(cells.size() + 2);
+        uint64_t *out = h->scratch.data();
+        size_t n = 0;
+        for (size_t i = 0; i < cells.size() && n < cells.size(); ++i) {
+            const uint64_t changed = cells[i] ^ before[i];
+            out[n] = i;
+            out[n + 1] = changed;
+            n += changed ? 2 : 0;
+        }
+        entry.keyframe = n >= cells.size();
+        if (!entry.keyframe)
+            entry.words.assign(out, out + n);
+    }
+    if (entry.keyframe) {
+        entry.words.swap(h->spare);
+        entry.words.assign(cells.begin(), cells.end());
+        h->delta_words = 0;
+    } else {
+        h->delta_words += entry.words.size();
+    }
+    h->words += entry.words.size();
+    h->entries.push_back(std::move(entry));
+
+    // Drop the oldest keyframes with their deltas, as long as another
+    // keyframe follows
+    while (h->words * sizeof(uint64_t) > h->limit) {
+        size_t next = 1;
+        while (next < h->entries.size() && !h->entries[next].keyframe)
+            next++;
+        if (next == h->entries.size())
+            break;
+        for (size_t i = 0; i < next; ++i)
+            h->words -= h->entries[i].words.size();
+        h->spare.swap(h->entries[0].words);
+        h->entries.erase(h->entries.begin(), h->entries.begin() + next);
+    }
+}
+
+// Applies a delta to a buffer, a generation forward or back
+inline void history_apply(const history_entry_t &entry, std::vector<uint64_t> &cells)
+{
+    const uint64_t *words = entry.words.data();
+    for (size_t i = 0; i < entry.words.size(); i += 2)
+        cells[words[i]] ^= words[i + 1];
+}
+
+// Puts the board back to a recorded generation and forgets those after it,
+// so that stepping from there records new ones. Returns false if the
+// generation isn't in the history.
+inline bool history_seek(history_t *h, board_t *b, uint64_t generation)
+{
+    if (h->entries.empty() || generation < h->entries.front().generation ||
+        generation > h->entries.back().generation)
+        return false;
+    std::vector<uint64_t> &cells = b->buffers[b->current];
+    const size_t target = generation - h->entries.front().generation;
+    size_t key = target;
+    while (!h->entries[key].keyframe)
+        key--;
+
+    // Words to go back from the current cells, impossible past a keyframe,
+    // and to go forward from the keyframe
+    size_t back = 0, forward = cells.size();
+    bool can_go_back = true;
+    for (size_t i = target + 1; i < h->entries.size(); ++i) {
+        can_go_back = can_go_back && !h->entries[i].keyframe;
+        back += h->entries[i].words.size();
+    }
+    for (size_t i = key + 1; i <= target; ++i)
+        forward += h->entries[i].words.size();
+    if (can_go_back && back <= forward) {
+        for (size_t i = h->entries.size() - 1; i > target; --i)
+            history_apply(h->entries[i], cells);
+    } else {
+        cells = h->entries[key].words;
+        for (size_t i = key + 1; i <= target; ++i)
+            history_apply(h->entries[i], cells);
+    }
+
+    for (size_t i = target + 1; i < h->entries.size(); ++i)
+        h->words -= h->entries[i].words.size();
+    h->entries.erase(h->entries.begin() + target + 1, h->entries.end());
+    h->delta_words = 0;
+    for (size_t i = key + 1; i <= target; ++i)
+        h->delta_words += h->entries[i].words.size();
+    return true;
+}
+
+#endif // HISTORY_HPP
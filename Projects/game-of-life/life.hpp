@@ -0,0 +1,580 @@
+#ifndef LIFE_HPP
+#define LIFE_HPP
+
+#include <cstdint>
+#include "rule.hpp"
+
+// Vectorized kernels need GCC/Clang vector operators and x86 intrinsics.
+// Everything else, including MSVC and ARM, uses the scalar kernel.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define LIFE_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define LIFE_X86_SIMD 0
+#endif
+
+// Cells are packed 64 per word: cell x of a row is bit x % 64 of word x / 64.
+// Rows passed to the kernels must have a readable word before the first and
+// after the last one (guard words), so that the step needs no bounds checks.
+
+inline bool life_get(const uint64_t *row, int x)
+{
+    return (row[x >> 6] >> (x & 63)) & 1;
+}
+
+inline void life_set(uint64_t *row, int x, bool alive)
+{
+    const uint64_t bit = uint64_t(1) << (x & 63);
+    if (alive)
+        row[x >> 6] |= bit;
+    else
+        row[x >> 6] &= ~bit;
+}
+
+// Sets `length` cells of a row starting at x, a word at a time
+inline void life_set_run(uint64_t *row, int64_t x, int64_t length)
+{
+    while (length > 0) {
+        const int bit = x & 63;
+        const int n = int(length < 64 - bit ? length : 64 - bit);
+        const uint64_t mask = (n == 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1) << bit;
+        row[x >> 6] |= mask;
+        x += n;
+        length -= n;
+    }
+}
+
+// Index of the lowest set bit, w must not be 0
+inline int life_ctz(uint64_t w)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(w);
+#else
+    int n = 0;
+    while (!(w & 1)) {
+        w >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+// Index of the highest set bit, w must not be 0
+inline int life_msb(uint64_t w)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(w);
+#else
+    int n = 0;
+    while (w >>= 1)
+        n++;
+    return n;
+#endif
+}
+
+// Number of set bits
+inline int life_popcount(uint64_t w)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(w);
+#else
+    w = w - ((w >> 1) & 0x5555555555555555ull);
+    w = (w & 0x3333333333333333ull) + ((w >> 2) & 0x3333333333333333ull);
+    w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return int((w * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+// Live cells in every byte of a word, one count per byte. Unlike
+// life_popcount() it needs no popcount instruction, and counts of many
+// words add up in the bytes before they have to be summed.
+inline uint64_t life_byte_counts(uint64_t w)
+{
+    w = w - ((w >> 1) & 0x5555555555555555ull);
+    w = (w & 0x3333333333333333ull) + ((w >> 2) & 0x3333333333333333ull);
+    return (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+}
+
+// Sum of the bytes of a word, each up to 255
+inline uint64_t life_sum_bytes(uint64_t w)
+{
+    w = (w & 0x00FF00FF00FF00FFull) + ((w >> 8) & 0x00FF00FF00FF00FFull);
+    return (w * 0x0001000100010001ull) >> 48;
+}
+
+constexpr int life_words(int width)
+{
+    return (width + 63) / 64;
+}
+
+// Words a row is padded to, so that the widest kernel (8 words, AVX-512)
+// never needs a tail loop. Padding words are always dead.
+const int LIFE_VECTOR_WORDS = 8;
+
+constexpr int life_padded_words(int width)
+{
+    return (life_words(width) + LIFE_VECTOR_WORDS - 1) / LIFE_VECTOR_WORDS * LIFE_VECTOR_WORDS;
+}
+
+// Valid cells of the last word of a row
+inline uint64_t life_last_mask(int width)
+{
+    return (width % 64 == 0) ? ~uint64_t(0) : (uint64_t(1) << (width % 64)) - 1;
+}
+
+inline uint64_t life_mix(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBull;
+    h ^= h >> 31;
+    return h;
+}
+
+// Hash of the word of cells [64 * column, 64 * column + 64) of row y, 0 for
+// a dead word. The hash of a generation is the XOR of these over all words,
+// so it can be updated from the words that changed: XOR out the old word's
+// hash, XOR in the new one's. The same cells hash the same in any engine.
+inline uint64_t life_word_hash(int64_t column, int64_t y, uint64_t word)
+{
+    if (!word)
+        return 0;
+    return life_mix(word ^ life_mix(uint64_t(y) * 0x9E3779B97F4A7C15ull + uint64_t(column)));
+}
+
+// Population of a generation and what changed since the one before. Steps
+// keep it up to date from the words they compute anyway, so watching a huge
+// run costs no pass over its cells: births and deaths are counted in the
+// words that changed, the population follows from them, and the bounding
+// box comes from the rows as they are written.
+struct life_stats_t
+{
+    uint64_t population = 0;
+    uint64_t births = 0;
+    uint64_t deaths = 0;
+    // Bounding box of the live cells, [x0, x1) x [y0, y1), empty when
+    // x0 >= x1
+    int64_t x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+};
+
+inline void life_stats_empty_bounds(life_stats_t &s)
+{
+    s.x0 = s.y0 = INT64_MAX;
+    s.x1 = s.y1 = INT64_MIN;
+}
+
+inline void life_stats_add_bounds(life_stats_t &s, int64_t x0, int64_t y0, int64_t x1, int64_t y1)
+{
+    s.x0 = x0 < s.x0 ? x0 : s.x0;
+    s.y0 = y0 < s.y0 ? y0 : s.y0;
+    s.x1 = x1 > s.x1 ? x1 : s.x1;
+    s.y1 = y1 > s.y1 ? y1 : s.y1;
+}
+
+// Adds row y of `words` packed words, cells from x = 0, to the bounding box
+inline void life_stats_add_row(life_stats_t &s, const uint64_t *row, int words, int64_t y)
+{
+    int first = 0;
+    while (first < words && !row[first])
+        first++;
+    if (first == words)
+        return;
+    int last = words - 1;
+    while (!row[last])
+        last--;
+    life_stats_add_bounds(s, first * int64_t(64) + life_ctz(row[first]), y,
+                          last * int64_t(64) + life_msb(row[last]) + 1, y + 1);
+}
+
+// Counts the births and deaths between two versions of a word
+inline void life_stats_add_change(life_stats_t &s, uint64_t before, uint64_t after)
+{
+    s.births += life_popcount(after & ~before);
+    s.deaths += life_popcount(before & ~after);
+}
+
+// Same for two versions of a row, `last_mask` applied to the last word of
+// `before`. Without a branch per word: byte counts of up to 31 words add up
+// before they are summed, no byte goes past 248.
+inline void life_stats_add_changes(life_stats_t &s, const uint64_t *before, const uint64_t *after, int words,
+                                   uint64_t last_mask)
+{
+    for (int i = 0; i < words - 1;) {
+        const int end = words - 1 - i < 31 ? words - 1 : i + 31;
+        uint64_t births = 0, deaths = 0;
+        for (; i < end; ++i) {
+            births += life_byte_counts(after[i] & ~before[i]);
+            deaths += life_byte_counts(before[i] & ~after[i]);
+        }
+        s.births += life_sum_bytes(births);
+        s.deaths += life_sum_bytes(deaths);
+    }
+    life_stats_add_change(s, before[words - 1] & last_mask, after[words - 1]);
+}
+
+#if LIFE_X86_SIMD
+// Same with the popcount instruction, a word per cycle or so
+__attribute__((target("popcnt")))
+inline void life_stats_add_changes_popcnt(life_stats_t &s, const uint64_t *before, const uint64_t *after,
+                                          int words, uint64_t last_mask)
+{
+    uint64_t births = 0, deaths = 0;
+    for (int i = 0; i < words - 1; ++i) {
+        births += __builtin_popcountll(after[i] & ~before[i]);
+        deaths += __builtin_popcountll(before[i] & ~after[i]);
+    }
+    const uint64_t last = before[words - 1] & last_mask;
+    births += __builtin_popcountll(after[words - 1] & ~last);
+    deaths += __builtin_popcountll(last & ~after[words - 1]);
+    s.births += births;
+    s.deaths += deaths;
+}
+
+// And with AVX-512 popcounts of 8 words at a time. Padding words aren't
+// read, they may hold a ghost of a torus.
+__attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+inline void life_stats_add_changes_avx512(life_stats_t &s, const uint64_t *before, const uint64_t *after,
+                                          int words, uint64_t last_mask)
+{
+    __m512i births = _mm512_setzero_si512(), deaths = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 8 < words; i += 8) {
+        const __m512i b = _mm512_loadu_si512(before + i), a = _mm512_loadu_si512(after + i);
+        births = _mm512_add_epi64(births, _mm512_popcnt_epi64(_mm512_andnot_si512(b, a)));
+        deaths = _mm512_add_epi64(deaths, _mm512_popcnt_epi64(_mm512_andnot_si512(a, b)));
+    }
+    life_stats_add_changes_popcnt(s, before + i, after + i, words - i, last_mask);
+    s.births += _mm512_reduce_add_epi64(births);
+    s.deaths += _mm512_reduce_add_epi64(deaths);
+}
+#endif
+
+typedef void (*life_change_counter)(life_stats_t &s, const uint64_t *before, const uint64_t *after, int words,
+                                    uint64_t last_mask);
+
+// Fastest life_stats_add_changes() the CPU supports
+inline life_change_counter life_select_change_counter()
+{
+#if LIFE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512vpopcntdq"))
+        return life_stats_add_changes_avx512;
+    if (__builtin_cpu_supports("popcnt"))
+        return life_stats_add_changes_popcnt;
+#endif
+    return life_stats_add_changes;
+}
+
+// The bitwise logic below is written once for any type with &, |, ^ and ~:
+// uint64_t for the scalar kernel, __m256i and __m512i for the vector ones.
+// Always inlined, so vector instantiations get compiled with the target
+// options of the kernel that uses them. Vectors are passed by reference,
+// passing them by value outside of an AVX function changes the ABI.
+#if defined(__GNUC__) || defined(__clang__)
+#define LIFE_INLINE inline __attribute__((always_inline))
+#else
+#define LIFE_INLINE inline
+#endif
+
+// Bit-sliced full adder: adds three bits in each lane
+template <typename T>
+LIFE_INLINE void life_add3(const T &a, const T &b, const T &c, T &sum, T &carry)
+{
+    const T t = a ^ b;
+    sum = t ^ c;
+    carry = (a & b) | (t & c);
+}
+
+// Exact number of alive cells around, bit-sliced over four planes:
+// count = ones + 2 * twos + 4 * fours + 8 * eights
+template <typename T>
+LIFE_INLINE void life_count(const T &nw, const T &n, const T &ne,
+                            const T &w, const T &e,
+                            const T &sw, const T &s, const T &se,
+                            T &ones, T &twos, T &fours, T &eights)
+{
+    // Each row of three first, then the rows together
+    T sum_n, carry_n, sum_s, carry_s;
+    life_add3(nw, n, ne, sum_n, carry_n);
+    life_add3(sw, s, se, sum_s, carry_s);
+    const T sum_m = w ^ e;
+    const T carry_m = w & e;
+
+    T carry, twos_partial, fours_partial;
+    life_add3(sum_n, sum_m, sum_s, ones, carry);
+    life_add3(carry_n, carry_m, carry_s, twos_partial, fours_partial);
+    twos = twos_partial ^ carry;
+    const T carry_twos = twos_partial & carry;
+    fours = fours_partial ^ carry_twos;
+    eights = fours_partial & carry_twos;
+}
+
+// Lanes where the count is exactly k
+template <typename T>
+LIFE_INLINE void life_count_is(int k, const T &ones, const T &twos, const T &fours, const T &eights,
+                               T &is_k)
+{
+    is_k = ((k & 1) ? ones : ~ones) & ((k & 2) ? twos : ~twos) &
+           ((k & 4) ? fours : ~fours) & ((k & 8) ? eights : ~eights);
+}
+
+// Rules are policies with step(): the next state of a word of cells given
+// their 8 neighbours shifted into place. Kernels are instantiated per rule,
+// so a rule known at compile time costs only the comparisons it uses.
+
+// Adds to `out` the lanes where the count is K and the rule makes the cell
+// alive, for K and all counts above
+template <uint16_t Birth, uint16_t Survive, int K, typename T>
+LIFE_INLINE void life_apply_static_rule(const T &center, const T &ones, const T &twos,
+                                        const T &fours, const T &eights, T &out)
+{
+    if constexpr (K <= 8) {
+        constexpr bool born = (Birth >> K) & 1;
+        constexpr bool survives = (Survive >> K) & 1;
+        if constexpr (born || survives) {
+            T is_k;
+            life_count_is(K, ones, twos, fours, eights, is_k);
+            if constexpr (born && survives)
+                out = out | is_k;
+            else if constexpr (born)
+                out = out | (is_k & ~center);
+            else
+                out = out | (is_k & center);
+        }
+        life_apply_static_rule<Birth, Survive, K + 1>(center, ones, twos, fours, eights, out);
+    }
+}
+
+template <uint16_t Birth, uint16_t Survive>
+struct life_static_rule_t
+{
+    static constexpr life_rule_t rule = { Birth, Survive };
+
+    explicit life_static_rule_t(const life_rule_t &) {}
+
+    template <typename T>
+    LIFE_INLINE void step(const T &nw, const T &n, const T &ne,
+                          const T &w, const T &center, const T &e,
+                          const T &sw, const T &s, const T &se, T &out) const
+    {
+        T ones, twos, fours, eights;
+        life_count(nw, n, ne, w, e, sw, s, se, ones, twos, fours, eights);
+        out = center ^ center;
+        life_apply_static_rule<Birth, Survive, 0>(center, ones, twos, fours, eights, out);
+    }
+};
+
+// B3/S23 only needs to know whether the count is 2 or 3, so everything
+// from 4 up is one saturated plane
+template <>
+struct life_static_rule_t<LIFE_CONWAY.birth, LIFE_CONWAY.survive>
+{
+    static constexpr life_rule_t rule = LIFE_CONWAY;
+
+    explicit life_static_rule_t(const life_rule_t &) {}
+
+    template <typename T>
+    LIFE_INLINE void step(const T &nw, const T &n, const T &ne,
+                          const T &w, const T &center, const T &e,
+                          const T &sw, const T &s, const T &se, T &out) const
+    {
+        // count = ones + 2 * twos + 4 * (anything in fours)
+        T sum_n, carry_n, sum_s, carry_s;
+        life_add3(nw, n, ne, sum_n, carry_n);
+        life_add3(sw, s, se, sum_s, carry_s);
+        const T sum_m = w ^ e;
+        const T carry_m = w & e;
+
+        T ones, carry;
+        life_add3(sum_n, sum_m, sum_s, ones, carry);
+        T twos_partial, fours_partial;
+        life_add3(carry_n, carry_m, carry_s, twos_partial, fours_partial);
+        const T twos = twos_partial ^ carry;
+        const T fours = fours_partial | (twos_partial & carry);
+
+        // 2 or 3 neighbours keep a cell alive, 3 give birth
+        out = twos & ~fours & (ones | center);
+    }
+};
+
+typedef life_static_rule_t<LIFE_CONWAY.birth, LIFE_CONWAY.survive> life_conway_t;
+
+// Any rule, read at runtime. The branches go the same way for every word.
+struct life_dynamic_rule_t
+{
+    life_rule_t rule;
+
+    explicit life_dynamic_rule_t(const life_rule_t &rule) : rule(rule) {}
+
+    template <typename T>
+    LIFE_INLINE void step(const T &nw, const T &n, const T &ne,
+                          const T &w, const T &center, const T &e,
+                          const T &sw, const T &s, const T &se, T &out) const
+    {
+        T ones, twos, fours, eights;
+        life_count(nw, n, ne, w, e, sw, s, se, ones, twos, fours, eights);
+        out = center ^ center;
+        for (int k = 0; k <= 8; ++k) {
+            const bool born = (rule.birth >> k) & 1;
+            const bool survives = (rule.survive >> k) & 1;
+            if (!born && !survives)
+                continue;
+            T is_k;
+            life_count_is(k, ones, twos, fours, eights, is_k);
+            if (born && survives)
+                out = out | is_k;
+            else if (born)
+                out = out | (is_k & ~center);
+            else
+                out = out | (is_k & center);
+        }
+    }
+};
+
+// Computes the next generation of one row. `words` is the row length in
+// words, bits past the board width in the last word are cleared.
+template <typename Rule>
+inline void life_step_row(const life_rule_t &rule, const uint64_t *above, const uint64_t *row,
+                          const uint64_t *below, uint64_t *out, int words, uint64_t last_mask)
+{
+    const Rule policy(rule);
+    for (int i = 0; i < words; ++i) {
+        // West neighbour of cell x is x - 1, so it is the row shifted
+        // towards higher bits, with the carry from the previous word
+        policy.step(
+            (above[i] << 1) | (above[i - 1] >> 63), above[i], (above[i] >> 1) | (above[i + 1] << 63),
+            (row[i] << 1) | (row[i - 1] >> 63), row[i], (row[i] >> 1) | (row[i + 1] << 63),
+            (below[i] << 1) | (below[i - 1] >> 63), below[i], (below[i] >> 1) | (below[i + 1] << 63),
+            out[i]);
+    }
+    out[words - 1] &= last_mask;
+}
+
+#if LIFE_X86_SIMD
+
+// Vector kernels compute whole vectors, so rows must be padded with
+// life_padded_words() and also have a guard word after the padding. Padding
+// words of `out` are cleared, the rest of the result matches life_step_row.
+
+// [row[-1], v0, v1, v2] and [v1, v2, v3, row[4]]: the lanes west and east
+// of v, shifted across lanes in-register
+__attribute__((target("avx2")))
+inline void life_neighbours_avx2(const uint64_t *row, const __m256i &v, __m256i &w, __m256i &e)
+{
+    const __m256i before = _mm256_blend_epi32(
+        _mm256_permute4x64_epi64(v, _MM_SHUFFLE(2, 1, 0, 3)),
+        _mm256_set1_epi64x(row[-1]), 0x03);
+    const __m256i after = _mm256_blend_epi32(
+        _mm256_permute4x64_epi64(v, _MM_SHUFFLE(0, 3, 2, 1)),
+        _mm256_set1_epi64x(row[4]), 0xC0);
+    w = _mm256_or_si256(_mm256_slli_epi64(v, 1), _mm256_srli_epi64(before, 63));
+    e = _mm256_or_si256(_mm256_srli_epi64(v, 1), _mm256_slli_epi64(after, 63));
+}
+
+template <typename Rule>
+__attribute__((target("avx2")))
+inline void life_step_row_avx2(const life_rule_t &rule, const uint64_t *above, const uint64_t *row,
+                               const uint64_t *below, uint64_t *out, int words, uint64_t last_mask)
+{
+    const Rule policy(rule);
+    const int padded = (words + LIFE_VECTOR_WORDS - 1) / LIFE_VECTOR_WORDS * LIFE_VECTOR_WORDS;
+    for (int i = 0; i < padded; i += 4) {
+        __m256i nw, ne, w, e, sw, se, next;
+        const __m256i n = _mm256_loadu_si256((const __m256i *) (above + i));
+        const __m256i c = _mm256_loadu_si256((const __m256i *) (row + i));
+        const __m256i s = _mm256_loadu_si256((const __m256i *) (below + i));
+        life_neighbours_avx2(above + i, n, nw, ne);
+        life_neighbours_avx2(row + i, c, w, e);
+        life_neighbours_avx2(below + i, s, sw, se);
+        policy.step(nw, n, ne, w, c, e, sw, s, se, next);
+        _mm256_storeu_si256((__m256i *) (out + i), next);
+    }
+    out[words - 1] &= last_mask;
+    for (int i = words; i < padded; ++i)
+        out[i] = 0;
+}
+
+// Same as above with 8 lanes: alignr shifts whole 64-bit lanes across the
+// concatenation of two vectors
+__attribute__((target("avx512f")))
+inline void life_neighbours_avx512(const uint64_t *row, const __m512i &v, __m512i &w, __m512i &e)
+{
+    const __m512i before = _mm512_alignr_epi64(v, _mm512_set1_epi64(row[-1]), 7);
+    const __m512i after = _mm512_alignr_epi64(_mm512_set1_epi64(row[8]), v, 1);
+    w = _mm512_or_si512(_mm512_slli_epi64(v, 1), _mm512_srli_epi64(before, 63));
+    e = _mm512_or_si512(_mm512_srli_epi64(v, 1), _mm512_slli_epi64(after, 63));
+}
+
+template <typename Rule>
+__attribute__((target("avx512f")))
+inline void life_step_row_avx512(const life_rule_t &rule, const uint64_t *above, const uint64_t *row,
+                                 const uint64_t *below, uint64_t *out, int words, uint64_t last_mask)
+{
+    const Rule policy(rule);
+    const int padded = (words + LIFE_VECTOR_WORDS - 1) / LIFE_VECTOR_WORDS * LIFE_VECTOR_WORDS;
+    for (int i = 0; i < padded; i += 8) {
+        __m512i nw, ne, w, e, sw, se, next;
+        const __m512i n = _mm512_loadu_si512(above + i);
+        const __m512i c = _mm512_loadu_si512(row + i);
+        const __m512i s = _mm512_loadu_si512(below + i);
+        life_neighbours_avx512(above + i, n, nw, ne);
+        life_neighbours_avx512(row + i, c, w, e);
+        life_neighbours_avx512(below + i, s, sw, se);
+        policy.step(nw, n, ne, w, c, e, sw, s, se, next);
+        _mm512_storeu_si512(out + i, next);
+    }
+    out[words - 1] &= last_mask;
+    for (int i = words; i < padded; ++i)
+        out[i] = 0;
+}
+
+#endif // LIFE_X86_SIMD
+
+typedef void (*life_row_kernel)(const life_rule_t &rule, const uint64_t *above, const uint64_t *row,
+                                const uint64_t *below, uint64_t *out, int words, uint64_t last_mask);
+
+// Widest kernel the CPU supports for a rule policy. All of them give
+// bit-identical results, the choice only affects speed.
+template <typename Rule>
+life_row_kernel life_row_kernel_for(bool vector)
+{
+#if LIFE_X86_SIMD
+    if (vector) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+            return life_step_row_avx512<Rule>;
+        if (__builtin_cpu_supports("avx2"))
+            return life_step_row_avx2<Rule>;
+    }
+#endif
+    return life_step_row<Rule>;
+}
+
+// Rules with their own kernels, the rest go through life_dynamic_rule_t
+template <typename Rule, typename... Rules>
+life_row_kernel life_pick_row_kernel(const life_rule_t &rule, bool vector)
+{
+    if (rule == Rule::rule)
+        return life_row_kernel_for<Rule>(vector);
+    if constexpr (sizeof...(Rules) > 0)
+        return life_pick_row_kernel<Rules...>(rule, vector);
+    else
+        return life_row_kernel_for<life_dynamic_rule_t>(vector);
+}
+
+// Kernel for the rule. Vector kernels need rows padded with
+// life_padded_words(), pass vector = false for rows that aren't.
+inline life_row_kernel life_select_row_kernel(const life_rule_t &rule, bool vector = true)
+{
+    return life_pick_row_kernel<
+        life_conway_t,
+        life_static_rule_t<life_mask("36"), life_mask("23")>,       // HighLife
+        life_static_rule_t<life_mask("3678"), life_mask("34678")>,  // Day & Night
+        life_static_rule_t<life_mask("2"), life_mask("")>,          // Seeds
+        life_static_rule_t<life_mask("3"), life_mask("012345678")>, // Life without Death
+        life_static_rule_t<life_mask("3"), life_mask("12345")>      // Maze
+        >(rule, vector);
+}
+
+#endif // LIFE_HPP
@@ -1,6 +1,27 @@
 #define RAYEXT_IMPLEMENTATION
 #include <raylib-ext.hpp>
+#include <cmath>
+#include <cstdio>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "life.hpp"
+#include "bands.hpp"
+#include "board.hpp"
+#include "hashlife.hpp"
+#include "sparse.hpp"
+#include "pattern.hpp"
+#include "multistate.hpp"
+#include "cycle.hpp"
+#include "history.hpp"
+#include "density.hpp"
+#include "triple.hpp"
 
 const Color BG_COLOR = BLACK;
 const Color ACTIVE_COLOR = GREEN;
@@ -9,94 +30,1079 @@ const Color BORDER_COLOR = DARKGRAY;
 const int WINDOW_W = 800;
 const int WINDOW_H = 800;
 
-const int SQUARE_SIZE = 20;
-const int BOARD_W = WINDOW_W / SQUARE_SIZE;
-const int BOARD_H = WINDOW_H / SQUARE_SIZE;
-bool board[BOARD_H][BOARD_W] = {0};
+// Board size unless given with --size
+const int DEFAULT_BOARD_W = 40;
+const int DEFAULT_BOARD_H = 40;
+// Most cells a board can have, from --size or grown by a pattern. Its two
+// buffers take 256 MB, or 2 GB with the byte per cell of multi-state rules.
+const int64_t MAX_BOARD_CELLS = int64_t(1) << 30;
 
-bool is_valid(int x, int y)
+board_t board;
+// Threads stepping bands of the board, started once for the whole game
+life_bands_t bands;
+uint64_t generation = 0;
+
+// Hashlife keeps its node store between jumps, so memoized results of
+// earlier jumps speed up the next ones
+const size_t HASHLIFE_MEMORY = size_t(256) << 20;
+hashlife_t hashlife;
+
+// In unbounded mode cells live in a sparse universe instead of the board
+bool unbounded = false;
+sparse_t universe;
+
+// Rule of the game, from --rule, a loaded pattern or cycled with R. Rows of
+// the board and of the sparse universe get their own kernels, only the
+// board's are padded for the vector ones.
+life_rule_t rule = LIFE_CONWAY;
+life_row_kernel step_row = life_select_row_kernel(rule);
+life_row_kernel step_chunk_row = life_select_row_kernel(rule, false);
+// Generations and Larger than Life rules run on a board of their own, one
+// byte per cell, the same size as the two-state one
+bool multi_state = false;
+multi_rule_t multi_rule;
+multi_board_t multi;
+// Position in the list of rules R cycles through: LIFE_RULES, then MULTI_RULES
+int rule_index = 0;
+// Ctrl+S saves here, RLE or Life 1.06 depending on the extension
+const char *save_path = "life.rle";
+// Steps one generation per STEP_SECONDS while running
+const double STEP_SECONDS = 0.1;
+bool is_running = false;
+// Hashes of two-state generations, to find when the game settles into a
+// still life or an oscillator. Once it does, jumps only step the remainder
+// of the period, and with stop_on_cycle (C) the game stops.
+cycle_t cycle;
+bool stop_on_cycle = false;
+// Set while the window thread has sent commands the simulation thread hasn't
+// taken yet. A torus jump steps generation by generation and gives up when
+// it is set, so that it can't keep QUIT or anything else waiting.
+std::atomic<bool> command_waiting{ false };
+// Recent generations of the board, to step back to with the left arrow
+// (Shift for a whole jump). Steps record them, edits forget them.
+const size_t HISTORY_MEMORY = size_t(256) << 20;
+history_t history;
+// Population, births, deaths and bounding box of two-state generations,
+// updated by the steps. Anything else that changes cells makes them
+// unknown until the next step counts them again.
+life_stats_t stats;
+bool stats_valid = false;
+// Zoomed-out frames of the board read block populations from `density`.
+// Steps keep it up to date, anything else that changes cells makes it
+// built again.
+density_t density;
+bool density_valid = false;
+// Every loaded pattern bumps `loads`, the window centers the view on the
+// pattern when it sees that
+uint64_t loads = 0;
+double pattern_center_x = 0, pattern_center_y = 0;
+
+// Viewport: the cell at the top-left corner of the window and the size of a
+// cell in pixels. Panned with W, A, S, D or the middle mouse button, zoomed
+// with the mouse wheel. Below a pixel per cell the size is 1 / 2^k, and a
+// pixel shows the density of a block of 2^k x 2^k cells.
+const float MIN_CELL_SIZE = 1.0f / 4096;
+const float MAX_CELL_SIZE = 64;
+// Grid lines are drawn only when cells are at least this big
+const float GRID_CELL_SIZE = 8;
+const float PAN_SPEED = 10; // Pixels per frame
+double view_x = 0;
+double view_y = 0;
+float cell_size = 20;
+
+// Visible cells are drawn as a texture, one pixel per cell (or block of
+// cells), scaled to the cell size in a single call. Its pixels are uploaded
+// only when the simulation publishes a new frame. Grid lines are cached in
+// a texture of the window too, and drawn again only when the zoom or the
+// view's offset within a cell changes.
+const int FRAME_W = WINDOW_W + 2;
+const int FRAME_H = WINDOW_H + 2;
+Texture2D cells_texture;
+RenderTexture2D grid_texture;
+// Cell size and offset in pixels of the first line of the cached grid
+float grid_cell_size = 0;
+float grid_offset_x = 0, grid_offset_y = 0;
+
+bool is_valid(int64_t x, int64_t y)
+{
+    return unbounded || board_contains(&board, x, y);
+}
+
+// Cells of the game, in whatever mode it is
+bool get_cell(int64_t x, int64_t y)
+{
+    if (unbounded)
+        return sparse_get(&universe, x, y);
+    if (multi_state)
+        return multi_get(&multi, x, y) == 1;
+    return board_get(&board, x, y);
+}
+
+// 0 for dead, 1 for alive and above for dying cells of multi-state rules
+int get_state(int64_t x, int64_t y)
 {
-    return ((x >= 0 && x < BOARD_W) && (y >= 0 && y < BOARD_H));
+    if (multi_state)
+        return multi_get(&multi, x, y);
+    return get_cell(x, y);
 }
 
+void set_cell(int64_t x, int64_t y, bool alive)
+{
+    cycle_reset(&cycle);
+    history_clear(&history);
+    stats_valid = false;
+    if (unbounded)
+        sparse_set(&universe, x, y, alive);
+    else if (multi_state)
+        multi_set(&multi, x, y, alive);
+    else
+        board_set(&board, x, y, alive);
+}
+
+// Whether a board of that size is allowed
+bool board_fits(int64_t width, int64_t height)
+{
+    return width > 0 && height > 0 && width <= MAX_BOARD_CELLS && height <= MAX_BOARD_CELLS &&
+           width * height <= MAX_BOARD_CELLS;
+}
+
+// Resizes the board of the current mode, all cells dead
+void resize_board(int width, int height)
+{
+    cycle_reset(&cycle);
+    history_clear(&history);
+    stats_valid = false;
+    if (width != board.width || height != board.height)
+        board_resize(&board, width, height);
+    else
+        board_clear(&board);
+    if (multi_state)
+        multi_resize(&multi, width, height);
+}
+
+// Switches between the board and the unbounded universe, carrying over the
+// cells. Cells of the universe outside of the board are dropped.
+void toggle_unbounded()
+{
+    // The sparse universe steps two-state rules only
+    if (multi_state)
+        return;
+    if (unbounded) {
+        board_clear(&board);
+        int64_t x0, y0, x1, y1;
+        if (sparse_bounds(&universe, x0, y0, x1, y1)) {
+            for (int64_t y = std::max<int64_t>(y0, 0); y < std::min<int64_t>(y1, board.height); ++y)
+                for (int64_t x = std::max<int64_t>(x0, 0); x < std::min<int64_t>(x1, board.width); ++x)
+                    board_set(&board, x, y, sparse_get(&universe, x, y));
+        }
+        sparse_clear(&universe);
+    } else {
+        for (int y = 0; y < board.height; ++y)
+            for (int x = 0; x < board.width; ++x)
+                if (board_get(&board, x, y))
+                    sparse_set(&universe, x, y, true);
+    }
+    unbounded = !unbounded;
+    // The edges of the board changed what comes next
+    cycle_reset(&cycle);
+    history_clear(&history);
+    stats_valid = false;
+}
+
+void set_rule(const life_rule_t &new_rule)
+{
+    rule = new_rule;
+    step_row = life_select_row_kernel(rule);
+    step_chunk_row = life_select_row_kernel(rule, false);
+    hashlife_set_rule(&hashlife, rule);
+    cycle_reset(&cycle);
+
+    // Back from a multi-state rule, live cells stay alive, dying ones die
+    if (multi_state) {
+        multi_state = false;
+        history_clear(&history);
+        stats_valid = false;
+        board_clear(&board);
+        for (int y = 0; y < board.height; ++y)
+            for (int x = 0; x < board.width; ++x)
+                board_set(&board, x, y, multi_get(&multi, x, y) == 1);
+        multi_resize(&multi, 0, 0);
+    }
+}
+
+void set_multi_rule(const multi_rule_t &new_rule)
+{
+    multi_rule = new_rule;
+    cycle_reset(&cycle);
+    if (multi_state)
+        return;
+    if (unbounded)
+        toggle_unbounded();
+    multi_state = true;
+    history_clear(&history);
+    multi_resize(&multi, board.width, board.height);
+    for (int y = 0; y < board.height; ++y)
+        for (int x = 0; x < board.width; ++x)
+            multi_set(&multi, x, y, board_get(&board, x, y));
+}
+
+// Any rule the game knows, in B/S, Generations or Larger than Life notation
+bool set_rule_text(const char *text)
+{
+    life_rule_t new_rule;
+    multi_rule_t new_multi_rule;
+    if (life_parse_rule(text, new_rule))
+        set_rule(new_rule);
+    else if (multi_parse_rule(text, new_multi_rule))
+        set_multi_rule(new_multi_rule);
+    else
+        return false;
+    return true;
+}
+
+void format_rule(char *text, size_t size)
+{
+    if (multi_state)
+        multi_format_rule(multi_rule, text, size);
+    else
+        life_format_rule(rule, text, size);
+}
+
+// Steps the game in whatever mode it is
 void update_board()
 {
-    bool buf[BOARD_H][BOARD_W] = {0};
-    for (int sy = 0; sy < BOARD_H; ++sy) {
-        for (int sx = 0; sx < BOARD_W; ++sx) {
-            // Count alive cells around
-            int alive = 0;
-            for (int i = 0; i < 9; ++i) {
-                int x = sx - 1 + i % 3;
-                int y = sy - 1 + i / 3;
-                if (is_valid(x, y) && (x != sx || y != sy))
-                    alive += board[y][x];
+    // Two-state steps update the hash from the words that changed, after
+    // it has been computed once from all cells
+    if (!multi_state && !cycle.valid) {
+        cycle.hash = unbounded ? sparse_hash(&universe) : board_hash(&board);
+        cycle.valid = true;
+        cycle_add(&cycle, generation);
+    }
+    // Statistics likewise
+    if (!multi_state && !stats_valid) {
+        stats = unbounded ? sparse_stats(&universe) : board_stats(&board);
+        stats_valid = true;
+    }
+    if (unbounded) {
+        sparse_step(&universe, step_chunk_row, rule, &cycle.hash, &stats);
+    } else if (multi_state) {
+        multi_step(&multi, multi_rule);
+    } else {
+        // The history gets this generation if it doesn't have it yet, and
+        // the next one from what the step changed
+        history_record(&history, &board, generation);
+        board_step(&board, &bands, step_row, rule, &cycle.hash, &stats, density_valid ? &density.dirty : nullptr);
+        history_record(&history, &board, generation + 1);
+    }
+    generation++;
+
+    // The period found shows in the window title
+    if (!multi_state && cycle_add(&cycle, generation) && stop_on_cycle)
+        is_running = false;
+}
+
+// Advances the board by any number of generations with Hashlife. Hashlife
+// runs on an unbounded plane, so unlike update_board() the edges of the
+// board don't kill anything: cells that leave the board are simply lost.
+// The unbounded universe keeps all of them.
+void jump_board(uint64_t generations)
+{
+    // Hashlife is for two-state rules only
+    if (multi_state)
+        return;
+    // Nor can its plane wrap around, so a torus is stepped until it cycles,
+    // or until there's a command to run
+    const bool torus = board.torus && !unbounded;
+    if (torus) {
+        for (; generations && !cycle.period; --generations) {
+            if (command_waiting)
+                return;
+            update_board();
+        }
+    }
+    // A cycling game needs no Hashlife: only the generations past the last
+    // whole period are stepped
+    if (cycle.period || torus) {
+        const uint64_t steps = cycle_steps(&cycle, generations);
+        // Skipped periods leave a gap in the history
+        if (steps != generations)
+            history_clear(&history);
+        generation += generations - steps;
+        for (uint64_t i = 0; i < steps; ++i)
+            update_board();
+        return;
+    }
+    cycle_reset(&cycle);
+    history_clear(&history);
+    stats_valid = false;
+    if (unbounded) {
+        // A chunk is a Hashlife block as it is
+        std::vector<hashlife_block_t> blocks;
+        for (auto &it : universe.chunks)
+            blocks.push_back({ sparse_key_x(it.first), sparse_key_y(it.first),
+                               hashlife_block(&hashlife, it.second->rows) });
+        hashlife_load(&hashlife, blocks);
+        hashlife_advance(&hashlife, generations);
+        sparse_clear(&universe);
+        hashlife_for_each(&hashlife, INT64_MIN / 2, INT64_MIN / 2, INT64_MAX / 2, INT64_MAX / 2,
+                          [](int64_t x, int64_t y) { sparse_set(&universe, x, y, true); });
+        generation += generations;
+        return;
+    }
+
+    hashlife_load_rows(&hashlife, board.width, board.height, [](int64_t y) { return board_row(&board, y); });
+    hashlife_advance(&hashlife, generations);
+    board_clear(&board);
+    hashlife_for_each(&hashlife, 0, 0, board.width, board.height,
+                      [](int64_t x, int64_t y) { board_set(&board, x, y, true); });
+    generation += generations;
+}
+
+// Takes the board back by up to `generations`, as far as its history goes,
+// and stops the game there
+void rewind_board(uint64_t generations)
+{
+    if (unbounded || multi_state || history.entries.empty())
+        return;
+    const uint64_t target = generation - std::min(generations, generation - history_oldest(&history));
+    if (history_seek(&history, &board, target)) {
+        generation = target;
+        is_running = false;
+        cycle_reset(&cycle);
+        stats_valid = false;
+    }
+}
+
+// Replaces all cells with a pattern file. The board grows to fit the
+// pattern, which goes into its middle; in the unbounded universe the
+// pattern keeps its top-left corner at (0, 0).
+bool load_pattern(const char *path)
+{
+    int64_t left = 0, top = 0, width = 0, height = 0;
+    const auto begin = [&](const pattern_info_t &info) {
+        // A pattern too big for the board changes nothing. Multi-state
+        // rules leave the unbounded universe, so they need the board too.
+        multi_rule_t new_multi_rule;
+        const int64_t w = std::max<int64_t>(board.width, info.width);
+        const int64_t h = std::max<int64_t>(board.height, info.height);
+        if ((!unbounded || multi_parse_rule(info.rule, new_multi_rule)) && !board_fits(w, h)) {
+            fprintf(stderr, "%s: pattern is too big for the board\n", path);
+            return false;
+        }
+        // Then the rule, which may leave the universe
+        if (!set_rule_text(info.rule))
+            fprintf(stderr, "%s: unsupported rule %s, keeping the current one\n", path, info.rule);
+        if (unbounded) {
+            sparse_clear(&universe);
+        } else {
+            resize_board(int(w), int(h));
+            left = (w - info.width) / 2;
+            top = (h - info.height) / 2;
+        }
+        width = info.width;
+        height = info.height;
+        return true;
+    };
+    // Cells of any state other than dead load alive
+    const auto run = [&](int64_t x, int64_t y, int64_t length) {
+        if (unbounded) {
+            for (int64_t i = 0; i < length; ++i)
+                sparse_set(&universe, x + i, y, true);
+        } else if (multi_state) {
+            multi_set_run(&multi, left + x, top + y, length);
+        } else {
+            board_set_run(&board, left + x, top + y, length);
+        }
+    };
+    if (!pattern_load(path, begin, run))
+        return false;
+
+    generation = 0;
+    is_running = false;
+    cycle_reset(&cycle);
+    history_clear(&history);
+    stats_valid = false;
+    loads++;
+    pattern_center_x = left + width / 2.0;
+    pattern_center_y = top + height / 2.0;
+    return true;
+}
+
+// Saves the board, or the bounding box of the universe
+bool save_pattern(const char *path)
+{
+    char rule_text[64];
+    format_rule(rule_text, sizeof(rule_text));
+    if (unbounded) {
+        int64_t x0, y0, x1, y1;
+        if (!sparse_bounds(&universe, x0, y0, x1, y1))
+            x0 = y0 = x1 = y1 = 0;
+        std::vector<uint64_t> row((x1 - x0 + 63) / 64);
+        return pattern_save(path, x1 - x0, y1 - y0, rule_text, [&](int64_t y) {
+            sparse_read_row(&universe, x0, y0 + y, x1 - x0, row.data());
+            return row.data();
+        });
+    }
+    if (multi_state) {
+        // Only live cells are saved, dying ones are dead in the file
+        std::vector<uint64_t> row(life_words(multi.width));
+        return pattern_save(path, multi.width, multi.height, rule_text, [&](int64_t y) {
+            std::fill(row.begin(), row.end(), 0);
+            const uint8_t *cells = multi_row(&multi, y);
+            for (int x = 0; x < multi.width; ++x)
+                if (cells[x] == 1)
+                    life_set(row.data(), x, true);
+            return row.data();
+        });
+    }
+    return pattern_save(path, board.width, board.height, rule_text,
+                        [](int64_t y) { return board_row(&board, y); });
+}
+
+// Simulation thread: once the window is open, it alone touches the cells
+// and everything above, and steps the game on its own clock, so that a slow
+// generation doesn't drop frames and vsync doesn't slow the game down.
+// The window thread sends it commands, like the mouse edits, through a
+// queue, and gets back frames through a lock-free triple buffer: the
+// visible cells as pixels and what the title shows.
+struct frame_t
+{
+    // Cells from (x0, y0), w x h pixels of `scale` x `scale` cells, rows
+    // FRAME_W pixels apart
+    int64_t x0 = 0, y0 = 0;
+    int w = 0, h = 0;
+    int scale = 1;
+    std::vector<Color> pixels;
+    // State of the game for the title and the board outline
+    char rule[64] = "";
+    uint64_t generation = 0;
+    bool running = false;
+    bool unbounded = false;
+    size_t chunks = 0;
+    int board_w = 0, board_h = 0;
+    bool torus = false;
+    uint64_t period = 0;
+    bool stop_on_cycle = false;
+    uint64_t history = 0; // Generations the board can go back
+    bool has_stats = false;
+    life_stats_t stats;
+    uint64_t loads = 0;
+    double center_x = 0, center_y = 0;
+};
+
+enum command_type_t
+{
+    COMMAND_SET_CELL, // x, y, alive; ignored while running
+    COMMAND_RUN,      // Starts or stops the game
+    COMMAND_JUMP,     // generations
+    COMMAND_REWIND,   // generations
+    COMMAND_UNBOUNDED,
+    COMMAND_TORUS,
+    COMMAND_RULE,     // text
+    COMMAND_LOAD,     // text is the path
+    COMMAND_SAVE,
+    COMMAND_STOP_ON_CYCLE, // Toggles stopping when the game cycles
+    COMMAND_VIEW,     // Cells the frames show: x, y, w, h, scale
+    COMMAND_QUIT,
+};
+
+struct command_t
+{
+    command_type_t type;
+    int64_t x = 0, y = 0;
+    int w = 0, h = 0;
+    int scale = 1;
+    bool alive = false;
+    uint64_t generations = 0;
+    std::string text;
+};
+
+// A command of that type with all arguments at their defaults, set the ones
+// it takes after
+command_t make_command(command_type_t type)
+{
+    command_t command;
+    command.type = type;
+    return command;
+}
+
+std::thread simulation;
+std::mutex command_lock;
+std::condition_variable command_cv;
+std::vector<command_t> command_queue;
+triple_buffer_t<frame_t> frames;
+// Cells the frames show, from the last COMMAND_VIEW
+int64_t view_cells_x0 = 0, view_cells_y0 = 0;
+int view_cells_w = 0, view_cells_h = 0;
+int view_cells_scale = 1;
+std::vector<uint32_t> density_counts;
+
+// Pixels of the live cells among bits [from, to) of packed words, out[0]
+// being the pixel of bit `from`
+void fill_live_pixels(const uint64_t *words, int64_t from, int64_t to, Color *out)
+{
+    for (int64_t i = from >> 6; i <= (to - 1) >> 6; ++i) {
+        for (uint64_t word = words[i]; word; word &= word - 1) {
+            const int64_t x = i * 64 + life_ctz(word);
+            if (x >= from && x < to)
+                out[x - from] = ACTIVE_COLOR;
+        }
+    }
+}
+
+// Pixels of a frame with a pixel per cell, dying cells fade out
+void capture_cells(frame_t *frame)
+{
+    const int64_t x0 = frame->x0, y0 = frame->y0;
+    const int w = frame->w, h = frame->h;
+    std::fill(frame->pixels.begin(), frame->pixels.begin() + size_t(h) * FRAME_W, BLANK);
+    std::vector<uint64_t> words(life_words(w));
+    for (int j = 0; j < h; ++j) {
+        const int64_t y = y0 + j;
+        Color *out = &frame->pixels[size_t(j) * FRAME_W];
+        if (unbounded) {
+            sparse_read_row(&universe, x0, y, w, words.data());
+            fill_live_pixels(words.data(), 0, w, out);
+            continue;
+        }
+        // Only the part of the row on the board
+        const int64_t from = std::max<int64_t>(x0, 0);
+        const int64_t to = std::min<int64_t>(x0 + w, board.width);
+        if (y < 0 || y >= board.height || from >= to)
+            continue;
+        if (multi_state) {
+            const uint8_t *cells = multi_row(&multi, y);
+            for (int64_t x = from; x < to; ++x)
+                if (cells[x])
+                    out[x - x0] = cells[x] == 1 ? ACTIVE_COLOR
+                                                : Fade(ACTIVE_COLOR, 1 - float(cells[x] - 1) / multi_rule.states);
+        } else {
+            fill_live_pixels(board_row(&board, y), from, to, out + (from - x0));
+        }
+    }
+}
+
+// Shade of a pixel with `count` live cells out of `area`. Even a single
+// live cell stays visible however far the view is zoomed out.
+Color density_color(uint64_t count, uint64_t area)
+{
+    if (!count)
+        return BLANK;
+    return Fade(ACTIVE_COLOR, std::max(sqrtf(float(count) / area), 0.25f));
+}
+
+// Pixels of a zoomed-out frame: live cells are counted in every block of
+// `scale` x `scale` cells. The board reads them from the density pyramid,
+// the unbounded universe from the chunks in view, zoomed out far enough
+// only from their populations. Multi-state boards count cells one by one.
+void capture_density(frame_t *frame)
+{
+    const int64_t scale = frame->scale;
+    const int shift = life_ctz(scale);
+    const int64_t bx0 = frame->x0 >> shift, by0 = frame->y0 >> shift;
+    const int w = frame->w, h = frame->h;
+    std::vector<uint32_t> &counts = density_counts;
+    counts.assign(size_t(w) * h, 0);
+    const auto add = [&](int64_t x, int64_t y, uint32_t n) {
+        const int64_t px = (x >> shift) - bx0, py = (y >> shift) - by0;
+        if (px >= 0 && px < w && py >= 0 && py < h)
+            counts[py * w + px] += n;
+    };
+
+    if (unbounded) {
+        // Blocks of a chunk or more take its population, smaller ones are
+        // counted from its rows
+        const auto count_chunk = [&](int64_t cx, int64_t cy, const sparse_chunk_t *chunk) {
+            if (scale >= SPARSE_CHUNK) {
+                add(cx * SPARSE_CHUNK, cy * SPARSE_CHUNK, chunk->population);
+                return;
+            }
+            const uint64_t mask = (uint64_t(1) << scale) - 1;
+            for (int y = chunk->y0; y < chunk->y1; ++y) {
+                const uint64_t row = chunk->rows[y];
+                for (int x = 0; x < SPARSE_CHUNK && row >> x; x += scale)
+                    if (const int n = life_popcount((row >> x) & mask))
+                        add(cx * SPARSE_CHUNK + x, cy * SPARSE_CHUNK + y, n);
             }
-            // Update current cell based on its neighbors
-            if (board[sy][sx])
-                buf[sy][sx] = (alive == 2 || alive == 3);
+        };
+        // Only chunks in view: looked up one by one when there are fewer of
+        // them than chunks in the universe, picked out of those otherwise
+        const int64_t cx0 = frame->x0 >> 6, cx1 = (frame->x0 + int64_t(w) * scale - 1) >> 6;
+        const int64_t cy0 = frame->y0 >> 6, cy1 = (frame->y0 + int64_t(h) * scale - 1) >> 6;
+        if (uint64_t(cx1 - cx0 + 1) * uint64_t(cy1 - cy0 + 1) <= universe.chunks.size()) {
+            for (int64_t cy = cy0; cy <= cy1; ++cy)
+                for (int64_t cx = cx0; cx <= cx1; ++cx)
+                    if (const sparse_chunk_t *chunk = sparse_find(&universe, sparse_key(cx, cy)))
+                        count_chunk(cx, cy, chunk);
+        } else {
+            for (auto &it : universe.chunks) {
+                const int64_t cx = sparse_key_x(it.first), cy = sparse_key_y(it.first);
+                if (cx >= cx0 && cx <= cx1 && cy >= cy0 && cy <= cy1)
+                    count_chunk(cx, cy, it.second);
+            }
+        }
+    } else if (multi_state) {
+        const int64_t x_end = std::min<int64_t>(board.width, (bx0 + w) << shift);
+        const int64_t y_end = std::min<int64_t>(board.height, (by0 + h) << shift);
+        for (int64_t y = std::max<int64_t>(frame->y0, 0); y < y_end; ++y) {
+            const uint8_t *cells = multi_row(&multi, y);
+            for (int64_t x = std::max<int64_t>(frame->x0, 0); x < x_end; ++x)
+                if (cells[x] == 1)
+                    add(x, y, 1);
+        }
+    } else if (scale >= DENSITY_BLOCK) {
+        const auto row = [](int64_t y) { return board_row(&board, y); };
+        if (!density_valid)
+            density_build(&density, board.width, board.height, row);
+        else
+            density_update(&density, board.width, board.height, row);
+        density_valid = true;
+        const int level = shift - life_ctz(DENSITY_BLOCK);
+        for (int py = 0; py < h; ++py)
+            for (int px = 0; px < w; ++px)
+                counts[py * w + px] = density_count(&density, level, bx0 + px, by0 + py);
+    } else {
+        // Blocks smaller than a level 0 one are counted from the words: a
+        // few bits of a few rows per pixel
+        const uint64_t mask = (uint64_t(1) << scale) - 1;
+        const int64_t y_end = std::min<int64_t>(board.height, (by0 + h) << shift);
+        const int64_t x_end = std::min<int64_t>(board.width, (bx0 + w) << shift);
+        for (int64_t y = std::max<int64_t>(frame->y0, 0); y < y_end; ++y) {
+            const uint64_t *cells = board_row(&board, y);
+            for (int64_t x = std::max<int64_t>(frame->x0, 0); x < x_end; x += scale)
+                if (const int n = life_popcount((cells[x >> 6] >> (x & 63)) & mask))
+                    add(x, y, n);
+        }
+    }
+
+    for (int py = 0; py < h; ++py) {
+        Color *out = &frame->pixels[size_t(py) * FRAME_W];
+        for (int px = 0; px < w; ++px)
+            out[px] = density_color(counts[py * w + px], uint64_t(scale) * scale);
+    }
+}
+
+// Fills the frame's pixels and copies the state of the game
+void capture_frame(frame_t *frame)
+{
+    if (frame->scale > 1)
+        capture_density(frame);
+    else
+        capture_cells(frame);
+
+    format_rule(frame->rule, sizeof(frame->rule));
+    frame->generation = generation;
+    frame->running = is_running;
+    frame->unbounded = unbounded;
+    frame->chunks = universe.chunks.size();
+    frame->period = cycle.period;
+    frame->stop_on_cycle = stop_on_cycle;
+    frame->history = history.entries.empty() ? 0 : generation - history_oldest(&history);
+    frame->has_stats = stats_valid && !multi_state;
+    frame->stats = stats;
+    frame->board_w = board.width;
+    frame->board_h = board.height;
+    frame->torus = board.torus && !multi_state;
+    frame->loads = loads;
+    frame->center_x = pattern_center_x;
+    frame->center_y = pattern_center_y;
+}
+
+// Returns false for COMMAND_QUIT
+bool run_command(const command_t &command)
+{
+    switch (command.type) {
+    case COMMAND_SET_CELL:
+        if (!is_running && is_valid(command.x, command.y))
+            set_cell(command.x, command.y, command.alive);
+        break;
+    case COMMAND_RUN:
+        is_running = !is_running;
+        break;
+    case COMMAND_JUMP:
+        jump_board(command.generations);
+        break;
+    case COMMAND_REWIND:
+        rewind_board(command.generations);
+        break;
+    case COMMAND_UNBOUNDED:
+        toggle_unbounded();
+        break;
+    case COMMAND_TORUS:
+        // Only the packed board wraps around
+        if (!unbounded && !multi_state) {
+            board.torus = !board.torus;
+            cycle_reset(&cycle);
+        }
+        break;
+    case COMMAND_RULE:
+        set_rule_text(command.text.c_str());
+        break;
+    case COMMAND_LOAD:
+        load_pattern(command.text.c_str());
+        break;
+    case COMMAND_SAVE:
+        save_pattern(save_path);
+        break;
+    case COMMAND_STOP_ON_CYCLE:
+        stop_on_cycle = !stop_on_cycle;
+        break;
+    case COMMAND_VIEW:
+        view_cells_x0 = command.x;
+        view_cells_y0 = command.y;
+        view_cells_w = command.w;
+        view_cells_h = command.h;
+        view_cells_scale = command.scale;
+        break;
+    case COMMAND_QUIT:
+        return false;
+    }
+    return true;
+}
+
+// Body of the simulation thread: runs commands as they come, steps the game
+// on its own clock while it is running and publishes a frame after either
+void simulate()
+{
+    using clock = std::chrono::steady_clock;
+    const auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(STEP_SECONDS));
+    clock::time_point next_step = clock::now();
+    std::vector<command_t> commands;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(command_lock);
+            const auto has_commands = [] { return !command_queue.empty(); };
+            if (is_running)
+                command_cv.wait_until(lock, next_step, has_commands);
             else
-                buf[sy][sx] = (alive == 3);
+                command_cv.wait(lock, has_commands);
+            commands.swap(command_queue);
+            command_waiting = false;
         }
+        const bool was_running = is_running;
+        for (const command_t &command : commands) {
+            if (!run_command(command))
+                return;
+            // Commands that may change cells other than by a step
+            if (command.type != COMMAND_VIEW && command.type != COMMAND_RUN && command.type != COMMAND_SAVE &&
+                command.type != COMMAND_STOP_ON_CYCLE && command.type != COMMAND_TORUS)
+                density_valid = false;
+        }
+        commands.clear();
+
+        const clock::time_point now = clock::now();
+        if (is_running && !was_running) {
+            next_step = now;
+        } else if (is_running && now >= next_step) {
+            update_board();
+            // A generation slower than the period doesn't pile up steps
+            next_step = std::max(next_step + period, now);
+        }
+
+        frame_t *frame = triple_back(&frames);
+        frame->x0 = view_cells_x0;
+        frame->y0 = view_cells_y0;
+        frame->w = view_cells_w;
+        frame->h = view_cells_h;
+        frame->scale = view_cells_scale;
+        capture_frame(frame);
+        triple_publish(&frames);
+    }
+}
+
+void send_command(const command_t &command)
+{
+    {
+        std::lock_guard<std::mutex> lock(command_lock);
+        command_queue.push_back(command);
+        command_waiting = true;
+    }
+    command_cv.notify_one();
+}
+
+// Pans with the keyboard and the middle mouse button, zooms around the
+// mouse cursor with the wheel
+void update_view()
+{
+    // Control is for shortcuts like Ctrl+S
+    if (!IsKeyDown(KEY_LEFT_CONTROL) && !IsKeyDown(KEY_RIGHT_CONTROL)) {
+        view_x += (IsKeyDown(KEY_D) - IsKeyDown(KEY_A)) * PAN_SPEED / cell_size;
+        view_y += (IsKeyDown(KEY_S) - IsKeyDown(KEY_W)) * PAN_SPEED / cell_size;
+    }
+    if (IsMouseButtonDown(MOUSE_BUTTON_MIDDLE)) {
+        const Vector2 delta = GetMouseDelta();
+        view_x -= delta.x / cell_size;
+        view_y -= delta.y / cell_size;
     }
-    // Save new generation to the board
-    memcpy(board, buf, sizeof(buf));
+
+    const float wheel = GetMouseWheelMove();
+    if (wheel != 0) {
+        // Keep the cell under the cursor in place
+        const double mouse_x = view_x + GetMouseX() / cell_size;
+        const double mouse_y = view_y + GetMouseY() / cell_size;
+        float size = cell_size * powf(1.25f, wheel);
+        // Below a pixel per cell only powers of two, so that every pixel
+        // shows a whole block of cells
+        if (size < 1)
+            size = exp2f(wheel > 0 ? ceilf(log2f(size)) : floorf(log2f(size)));
+        cell_size = std::clamp(size, MIN_CELL_SIZE, MAX_CELL_SIZE);
+        view_x = mouse_x - GetMouseX() / cell_size;
+        view_y = mouse_y - GetMouseY() / cell_size;
+    }
+}
+
+void update_title(const frame_t *frame, uint64_t jump)
+{
+    char title[384];
+    char details[256] = "";
+    if (frame->has_stats) {
+        const life_stats_t &s = frame->stats;
+        snprintf(details, sizeof(details), ", population = %llu (+%llu -%llu)",
+                 (unsigned long long) s.population, (unsigned long long) s.births, (unsigned long long) s.deaths);
+        if (s.x0 < s.x1)
+            snprintf(details + strlen(details), sizeof(details) - strlen(details), " in %lldx%lld",
+                     (long long) (s.x1 - s.x0), (long long) (s.y1 - s.y0));
+    }
+    if (frame->period)
+        snprintf(details + strlen(details), sizeof(details) - strlen(details), ", period = %llu",
+                 (unsigned long long) frame->period);
+    if (frame->stop_on_cycle)
+        strcat(details, ", stop on cycle");
+    if (frame->history)
+        snprintf(details + strlen(details), sizeof(details) - strlen(details), ", history = %llu",
+                 (unsigned long long) frame->history);
+    if (frame->unbounded)
+        snprintf(title, sizeof(title), "Creative Coding: Game of Life [%s, generation = %llu, jump = %llu, "
+                 "unbounded, chunks = %zu%s]", frame->rule,
+                 (unsigned long long) frame->generation, (unsigned long long) jump, frame->chunks, details);
+    else
+        snprintf(title, sizeof(title), "Creative Coding: Game of Life [%s, generation = %llu, jump = %llu, "
+                 "board = %dx%d%s%s]", frame->rule,
+                 (unsigned long long) frame->generation, (unsigned long long) jump,
+                 frame->board_w, frame->board_h, frame->torus ? ", torus" : "", details);
+    SetWindowTitle(title);
+}
+
+void init_render()
+{
+    for (frame_t &frame : frames.buffers)
+        frame.pixels.assign(size_t(FRAME_W) * FRAME_H, BLANK);
+    const Image image = GenImageColor(FRAME_W, FRAME_H, BLANK);
+    cells_texture = LoadTextureFromImage(image);
+    UnloadImage(image);
+    // Cells stay sharp squares when scaled up
+    SetTextureFilter(cells_texture, TEXTURE_FILTER_POINT);
+    grid_texture = LoadRenderTexture(WINDOW_W, WINDOW_H);
+}
+
+void unload_render()
+{
+    UnloadTexture(cells_texture);
+    UnloadRenderTexture(grid_texture);
 }
 
-int main()
+// Cells of the frame, uploaded to the texture when the frame is new. The
+// frame may lag behind the view by a step of the simulation, so it is drawn
+// where its own cells are.
+void draw_cells(const frame_t *frame, bool new_frame)
 {
+    if (new_frame)
+        // Only the rows in use go to the GPU
+        UpdateTextureRec(cells_texture, { 0, 0, float(FRAME_W), float(frame->h) }, frame->pixels.data());
+    const float pixel_size = frame->scale * cell_size;
+    DrawTexturePro(cells_texture, { 0, 0, float(frame->w), float(frame->h) },
+                   { float((frame->x0 - view_x) * cell_size), float((frame->y0 - view_y) * cell_size),
+                     frame->w * pixel_size, frame->h * pixel_size },
+                   { 0, 0 }, 0, WHITE);
+}
+
+// Lines between cells over the whole window, drawn into the cached texture
+// only when they move relative to the window
+void draw_grid()
+{
+    const float offset_x = float((floor(view_x) - view_x) * cell_size);
+    const float offset_y = float((floor(view_y) - view_y) * cell_size);
+    if (cell_size != grid_cell_size || offset_x != grid_offset_x || offset_y != grid_offset_y) {
+        BeginTextureMode(grid_texture);
+        ClearBackground(BLANK);
+        for (int i = 0; offset_y + i * cell_size <= WINDOW_H; ++i)
+            DrawLineV({ 0, offset_y + i * cell_size }, { float(WINDOW_W), offset_y + i * cell_size }, BORDER_COLOR);
+        for (int i = 0; offset_x + i * cell_size <= WINDOW_W; ++i)
+            DrawLineV({ offset_x + i * cell_size, 0 }, { offset_x + i * cell_size, float(WINDOW_H) }, BORDER_COLOR);
+        EndTextureMode();
+        grid_cell_size = cell_size;
+        grid_offset_x = offset_x;
+        grid_offset_y = offset_y;
+    }
+    // Render textures are stored upside down
+    DrawTextureRec(grid_texture.texture, { 0, 0, float(WINDOW_W), -float(WINDOW_H) }, { 0, 0 }, WHITE);
+}
+
+int main(int argc, char **argv)
+{
+    int board_w = DEFAULT_BOARD_W;
+    int board_h = DEFAULT_BOARD_H;
+    const char *load_path = nullptr;
+    hashlife_init(&hashlife, HASHLIFE_MEMORY);
+    history_init(&history, HISTORY_MEMORY);
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &board_w, &board_h) != 2 || !board_fits(board_w, board_h)) {
+                fprintf(stderr, "Board size must be WIDTHxHEIGHT, like 10000x10000, at most %lld cells\n",
+                        (long long) MAX_BOARD_CELLS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--rule") == 0 && i + 1 < argc) {
+            if (!set_rule_text(argv[++i])) {
+                fprintf(stderr, "Rule must be like B3/S23 (without B0), B2/S/C3 or "
+                        "R5,C0,M1,S34..58,B34..45,NM\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+            save_path = argv[++i];
+        } else if (strcmp(argv[i], "--torus") == 0) {
+            board.torus = true;
+        } else {
+            load_path = argv[i];
+        }
+    }
+    // A multi-state --rule sized its board to the empty one, this sizes both
+    resize_board(board_w, board_h);
+    if (load_path && !load_pattern(load_path))
+        return 1;
+
     InitWindow(WINDOW_W, WINDOW_H, "Creative Coding: Game of Life");
     SetTargetFPS(60);
 
-    // Game state
-    bool is_running = false;
-    float timeout = 0;
+    life_bands_init(&bands, std::thread::hardware_concurrency());
+    init_render();
+
+    // From here on the cells belong to the simulation thread
+    uint64_t centered_loads = 0;
+    simulation = std::thread(simulate);
+
+    // Generations per Hashlife jump, changed with up and down arrows
+    uint64_t jump = 1024;
+    // Commands sent last, the view and mouse edits are sent only when they
+    // change
+    command_t view = make_command(COMMAND_VIEW);
+    command_t edit = make_command(COMMAND_SET_CELL);
 
     while (!WindowShouldClose()) {
+        const bool new_frame = triple_acquire(&frames);
+        const frame_t *frame = triple_front(&frames);
+        // Center the view on a newly loaded pattern
+        if (frame->loads != centered_loads) {
+            view_x = frame->center_x - WINDOW_W / 2.0 / cell_size;
+            view_y = frame->center_y - WINDOW_H / 2.0 / cell_size;
+            centered_loads = frame->loads;
+        }
+        update_view();
+
+        // Zoomed out, a pixel of the frame is a block of scale x scale cells
+        const int scale = cell_size < 1 ? int(lroundf(1 / cell_size)) : 1;
+        const int64_t block_x = int64_t(floor(view_x / scale)), block_y = int64_t(floor(view_y / scale));
+        command_t next_view = make_command(COMMAND_VIEW);
+        next_view.x = block_x * scale;
+        next_view.y = block_y * scale;
+        next_view.w = int(std::min<int64_t>(ceil((view_x + WINDOW_W / cell_size) / scale) - block_x, FRAME_W));
+        next_view.h = int(std::min<int64_t>(ceil((view_y + WINDOW_H / cell_size) / scale) - block_y, FRAME_H));
+        next_view.scale = scale;
+        if (next_view.x != view.x || next_view.y != view.y || next_view.w != view.w || next_view.h != view.h ||
+            next_view.scale != view.scale) {
+            view = next_view;
+            send_command(view);
+        }
+
         // Draw on the board
-        if (!is_running) {
-            int sx = GetMouseX() / SQUARE_SIZE;
-            int sy = GetMouseY() / SQUARE_SIZE;
-            if (IsMouseButtonDown(MOUSE_BUTTON_LEFT))
-                board[sy][sx] = 1;
-            else if (IsMouseButtonDown(MOUSE_BUTTON_RIGHT))
-                board[sy][sx] = 0;
+        if (!frame->running && (IsMouseButtonDown(MOUSE_BUTTON_LEFT) || IsMouseButtonDown(MOUSE_BUTTON_RIGHT))) {
+            command_t next_edit = make_command(COMMAND_SET_CELL);
+            next_edit.x = int64_t(floor(view_x + GetMouseX() / cell_size));
+            next_edit.y = int64_t(floor(view_y + GetMouseY() / cell_size));
+            next_edit.alive = IsMouseButtonDown(MOUSE_BUTTON_LEFT);
+            if (next_edit.x != edit.x || next_edit.y != edit.y || next_edit.alive != edit.alive) {
+                edit = next_edit;
+                send_command(edit);
+            }
+        } else {
+            // The next press edits even the same cell again
+            edit.x = INT64_MIN;
         }
 
         // Change game state
         if (IsKeyPressed(KEY_SPACE))
-            is_running = !is_running;
+            send_command(make_command(COMMAND_RUN));
+        if (IsKeyPressed(KEY_UP) && jump < (uint64_t(1) << 62))
+            jump *= 2;
+        if (IsKeyPressed(KEY_DOWN) && jump > 1)
+            jump /= 2;
+        if (IsKeyPressed(KEY_H)) {
+            command_t command = make_command(COMMAND_JUMP);
+            command.generations = jump;
+            send_command(command);
+        }
+        if (IsKeyPressed(KEY_LEFT)) {
+            command_t command = make_command(COMMAND_REWIND);
+            command.generations = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT) ? jump : 1;
+            send_command(command);
+        }
+        if (IsKeyPressed(KEY_U))
+            send_command(make_command(COMMAND_UNBOUNDED));
+        if (IsKeyPressed(KEY_T))
+            send_command(make_command(COMMAND_TORUS));
+        if (IsKeyPressed(KEY_C))
+            send_command(make_command(COMMAND_STOP_ON_CYCLE));
+        if (IsKeyPressed(KEY_R)) {
+            // Two-state rules first, then multi-state ones
+            rule_index = (rule_index + 1) % (LIFE_RULE_COUNT + MULTI_RULE_COUNT);
+            command_t command = make_command(COMMAND_RULE);
+            command.text = rule_index < LIFE_RULE_COUNT ? LIFE_RULES[rule_index].rule
+                                                        : MULTI_RULES[rule_index - LIFE_RULE_COUNT].rule;
+            send_command(command);
+        }
+        if (IsKeyPressed(KEY_S) && (IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL)))
+            send_command(make_command(COMMAND_SAVE));
+        // Pattern files dropped on the window replace the cells
+        if (IsFileDropped()) {
+            FilePathList files = LoadDroppedFiles();
+            command_t command = make_command(COMMAND_LOAD);
+            command.text = files.paths[0];
+            send_command(command);
+            UnloadDroppedFiles(files);
+        }
+        update_title(frame, jump);
 
         BeginDrawing();
         {
             ClearBackground(BG_COLOR);
-            // Draw squares
-            for (int sy = 0; sy < BOARD_H; ++sy)
-                for (int sx = 0; sx < BOARD_W; ++sx)
-                    if (board[sy][sx])
-                        DrawRectangle(sx * SQUARE_SIZE, sy * SQUARE_SIZE,
-                                    SQUARE_SIZE, SQUARE_SIZE, ACTIVE_COLOR);
-            // Draw horizontal lines
-            for (int y = 0; y <= WINDOW_H; y += SQUARE_SIZE)
-                DrawLine(0, y, WINDOW_W, y, BORDER_COLOR);
-            // Draw vertical lines
-            for (int x = 0; x <= WINDOW_W; x += SQUARE_SIZE)
-                DrawLine(x, 0, x, WINDOW_H, BORDER_COLOR);
-        }
-        EndDrawing();
 
-        // Update frame only after timeout
-        if (timeout <= 0) {
-            timeout = 0.1;
-        } else {
-            timeout -= GetFrameTime();
-            continue;
+            draw_cells(frame, new_frame);
+            // Board on the screen, clamped so that it fits in an int
+            const double left = std::clamp(-view_x * cell_size, -1.0, double(WINDOW_W));
+            const double top = std::clamp(-view_y * cell_size, -1.0, double(WINDOW_H));
+            const double right = std::clamp((frame->board_w - view_x) * cell_size, -1.0, double(WINDOW_W) + 1);
+            const double bottom = std::clamp((frame->board_h - view_y) * cell_size, -1.0, double(WINDOW_H) + 1);
+            if (cell_size >= GRID_CELL_SIZE) {
+                // The grid covers the board only, unless there is no board
+                if (!frame->unbounded)
+                    BeginScissorMode(int(left), int(top), int(right - left), int(bottom - top));
+                draw_grid();
+                if (!frame->unbounded)
+                    EndScissorMode();
+            }
+            if (!frame->unbounded)
+                DrawRectangleLinesEx({ float(left), float(top), float(right - left), float(bottom - top) },
+                                     1, BORDER_COLOR);
         }
-
-        if (is_running)
-            update_board();
+        EndDrawing();
     }
+    send_command(make_command(COMMAND_QUIT));
+    simulation.join();
+    unload_render();
     CloseWindow();
 
+    sparse_destroy(&universe);
+    life_bands_destroy(&bands);
+
     return 0;
 }
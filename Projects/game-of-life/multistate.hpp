@@ -0,0 +1,295 @@
+#ifndef MULTISTATE_HPP
+#define MULTISTATE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "rule.hpp"
+
+// Rule families that don't fit in one bit per cell or in a 3x3 block:
+//
+// Generations ("B2/S/C3", Brian's Brain): a live cell that doesn't survive
+// starts dying instead of becoming dead, and goes through states 2 to
+// C - 1 before it is dead. Only live cells (state 1) are counted and dying
+// cells can't be born into.
+//
+// Larger than Life ("R5,C0,M1,S34..58,B34..45,NM", Bosco's rule): counts
+// in a (2R + 1) x (2R + 1) square, optionally with the cell itself (M1),
+// birth and survival given as ranges. C above 2 adds decay as above.
+//
+// Both are stepped by the same code with one byte per cell. Neighbour
+// counts come from running window sums: horizontal sums of a row from its
+// prefix sums, added to per-column vertical sums as the window slides down,
+// so a step costs the same for any R.
+
+struct multi_rule_t
+{
+    bool ltl;     // Larger than Life, Generations otherwise
+    int radius;   // 1 for Generations
+    int states;   // 2 means no decay
+    bool middle;  // The cell counts itself
+    // Generations lists
+    uint16_t birth;
+    uint16_t survive;
+    // Larger than Life ranges
+    int birth_min, birth_max;
+    int survive_min, survive_max;
+    // Whether count n gives birth/survives, for n up to (2R + 1)^2
+    std::vector<uint8_t> born;
+    std::vector<uint8_t> survives;
+};
+
+const int MULTI_MAX_RADIUS = 500;
+const int MULTI_MAX_STATES = 256;
+
+struct multi_named_rule_t
+{
+    const char *name;
+    const char *rule;
+};
+
+const multi_named_rule_t MULTI_RULES[] = {
+    { "Brian's Brain", "B2/S/C3" },
+    { "Star Wars", "B2/S345/C4" },
+    { "Bosco's Rule", "R5,C0,M1,S34..58,B34..45,NM" },
+    { "Majority", "R4,C0,M1,S41..81,B41..81,NM" },
+};
+const int MULTI_RULE_COUNT = sizeof(MULTI_RULES) / sizeof(MULTI_RULES[0]);
+
+inline void multi_build_tables(multi_rule_t &rule)
+{
+    const int cells = (2 * rule.radius + 1) * (2 * rule.radius + 1);
+    rule.born.assign(cells + 1, 0);
+    rule.survives.assign(cells + 1, 0);
+    for (int n = 0; n <= cells; ++n) {
+        if (rule.ltl) {
+            rule.born[n] = n >= rule.birth_min && n <= rule.birth_max;
+            rule.survives[n] = n >= rule.survive_min && n <= rule.survive_max;
+        } else if (n <= 8) {
+            rule.born[n] = (rule.birth >> n) & 1;
+            rule.survives[n] = (rule.survive >> n) & 1;
+        }
+    }
+}
+
+// "R5,C0,M1,S34..58,B34..45,NM", Moore (square) neighbourhoods only
+inline bool multi_parse_ltl(const char *text, multi_rule_t &rule)
+{
+    rule.ltl = true;
+    rule.radius = 0;
+    rule.states = 2;
+    rule.middle = false;
+    rule.birth = rule.survive = 0;
+    rule.birth_min = rule.survive_min = 1;
+    rule.birth_max = rule.survive_max = 0;
+    for (const char *c = text; *c && *c != ':';) {
+        const char key = *c++;
+        char *end;
+        const long value = strtol(c, &end, 10);
+        if (key == 'N') {
+            if (*c != 'M')
+                return false;
+            end = (char *) c + 1;
+        } else if (end == c) {
+            return false;
+        } else if (key == 'R') {
+            rule.radius = int(value);
+        } else if (key == 'C') {
+            rule.states = std::max(int(value), 2);
+        } else if (key == 'M') {
+            rule.middle = value != 0;
+        } else if (key == 'S' || key == 'B') {
+            if (strncmp(end, "..", 2) != 0)
+                return false;
+            const char *max = end + 2;
+            const long value_max = strtol(max, &end, 10);
+            if (end == max)
+                return false;
+            (key == 'S' ? rule.survive_min : rule.birth_min) = int(value);
+            (key == 'S' ? rule.survive_max : rule.birth_max) = int(value_max);
+        } else {
+            return false;
+        }
+        c = end;
+        if (*c == ',')
+            c++;
+    }
+    return rule.radius >= 1 && rule.radius <= MULTI_MAX_RADIUS && rule.states <= MULTI_MAX_STATES &&
+           rule.birth_min > 0;
+}
+
+// "B2/S/C3" or Golly's older "/2/3" (survival, birth, states)
+inline bool multi_parse_generations(const char *text, multi_rule_t &rule)
+{
+    const char *slash = strrchr(text, '/');
+    if (!slash)
+        return false;
+    const char *states = slash + 1;
+    if (*states == 'C' || *states == 'c' || *states == 'G' || *states == 'g')
+        states++;
+    char *end;
+    const long count = strtol(states, &end, 10);
+    if (end == states || (*end && *end != ':') || count < 2 || count > MULTI_MAX_STATES)
+        return false;
+
+    // The rest is an ordinary B/S rule
+    char life[32];
+    const size_t length = slash - text;
+    if (length >= sizeof(life))
+        return false;
+    memcpy(life, text, length);
+    life[length] = 0;
+    life_rule_t two_state;
+    if (!life_parse_rule(life, two_state))
+        return false;
+
+    rule.ltl = false;
+    rule.radius = 1;
+    rule.states = int(count);
+    rule.middle = false;
+    rule.birth = two_state.birth;
+    rule.survive = two_state.survive;
+    return true;
+}
+
+inline bool multi_parse_rule(const char *text, multi_rule_t &rule)
+{
+    multi_rule_t result;
+    const bool ok = (text[0] == 'R' && text[1] >= '0' && text[1] <= '9')
+                        ? multi_parse_ltl(text, result)
+                        : multi_parse_generations(text, result);
+    if (!ok)
+        return false;
+    multi_build_tables(result);
+    rule = result;
+    return true;
+}
+
+inline void multi_format_rule(const multi_rule_t &rule, char *text, size_t size)
+{
+    if (rule.ltl) {
+        snprintf(text, size, "R%d,C%d,M%d,S%d..%d,B%d..%d,NM", rule.radius,
+                 rule.states > 2 ? rule.states : 0, rule.middle ? 1 : 0,
+                 rule.survive_min, rule.survive_max, rule.birth_min, rule.birth_max);
+    } else {
+        char life[32];
+        life_format_rule({ rule.birth, rule.survive }, life, sizeof(life));
+        snprintf(text, size, "%s/C%d", life, rule.states);
+    }
+}
+
+// Bounded board, one byte per cell: 0 dead, 1 alive, 2 and up dying.
+// Two buffers swap after every step, like board_t.
+struct multi_board_t
+{
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> buffers[2];
+    int current = 0;
+    // Scratch sums of the step, one per column
+    std::vector<int32_t> column_sums;
+    std::vector<int32_t> prefix;
+};
+
+inline void multi_resize(multi_board_t *b, int width, int height)
+{
+    b->width = width;
+    b->height = height;
+    for (std::vector<uint8_t> &buffer : b->buffers)
+        buffer.assign(size_t(width) * height, 0);
+    b->current = 0;
+    b->column_sums.assign(width, 0);
+    b->prefix.assign(width + 1, 0);
+}
+
+inline uint8_t *multi_row(multi_board_t *b, int y, int buffer)
+{
+    return b->buffers[buffer].data() + size_t(y) * b->width;
+}
+
+inline uint8_t *multi_row(multi_board_t *b, int y)
+{
+    return multi_row(b, y, b->current);
+}
+
+inline int multi_get(multi_board_t *b, int x, int y)
+{
+    return multi_row(b, y)[x];
+}
+
+inline void multi_set(multi_board_t *b, int x, int y, int state)
+{
+    multi_row(b, y)[x] = state;
+}
+
+// Makes a run of cells of row y alive, clipped to the board
+inline void multi_set_run(multi_board_t *b, int64_t x, int64_t y, int64_t length)
+{
+    if (y < 0 || y >= b->height)
+        return;
+    const int64_t x0 = std::max<int64_t>(x, 0);
+    const int64_t x1 = std::min<int64_t>(x + length, b->width);
+    if (x0 < x1)
+        memset(multi_row(b, int(y)) + x0, 1, x1 - x0);
+}
+
+inline void multi_clear(multi_board_t *b)
+{
+    std::fill(b->buffers[b->current].begin(), b->buffers[b->current].end(), 0);
+}
+
+// Adds sign * (live cells of row y within the radius) to every column sum
+inline void multi_add_row(multi_board_t *b, int y, int radius, int sign)
+{
+    const uint8_t *row = multi_row(b, y);
+    int32_t *prefix = b->prefix.data();
+    prefix[0] = 0;
+    for (int x = 0; x < b->width; ++x)
+        prefix[x + 1] = prefix[x] + (row[x] == 1);
+    int32_t *sums = b->column_sums.data();
+    for (int x = 0; x < b->width; ++x)
+        sums[x] += sign * (prefix[std::min(x + radius + 1, b->width)] - prefix[std::max(x - radius, 0)]);
+}
+
+// Computes the next generation into the other buffer and swaps. Cells
+// outside the board are dead.
+inline void multi_step(multi_board_t *b, const multi_rule_t &rule)
+{
+    const int radius = rule.radius;
+    std::fill(b->column_sums.begin(), b->column_sums.end(), 0);
+    // Window of the first row: rows -R to R
+    for (int y = 0; y <= radius && y < b->height; ++y)
+        multi_add_row(b, y, radius, 1);
+
+    const uint8_t *born = rule.born.data();
+    const uint8_t *survives = rule.survives.data();
+    const uint8_t dying = rule.states > 2 ? 2 : 0;
+    const int last = rule.states - 1;
+    for (int y = 0; y < b->height; ++y) {
+        const uint8_t *row = multi_row(b, y);
+        uint8_t *out = multi_row(b, y, !b->current);
+        const int32_t *sums = b->column_sums.data();
+        for (int x = 0; x < b->width; ++x) {
+            const uint8_t state = row[x];
+            const int count = sums[x] - (state == 1 && !rule.middle);
+            if (state == 0)
+                out[x] = born[count];
+            else if (state == 1)
+                out[x] = survives[count] ? 1 : dying;
+            else
+                out[x] = state == last ? 0 : state + 1;
+        }
+
+        // Slide the window down a row
+        if (y + radius + 1 < b->height)
+            multi_add_row(b, y + radius + 1, radius, 1);
+        if (y - radius >= 0)
+            multi_add_row(b, y - radius, radius, -1);
+    }
+    b->current = !b->current;
+}
+
+#endif // MULTISTATE_HPP
@@ -0,0 +1,411 @@
+#ifndef PATTERN_HPP
+#define PATTERN_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "life.hpp"
+
+// Pattern files: RLE and Life 1.06.
+//
+// Files are parsed as a stream of characters through a fixed buffer, cells
+// are handed out as runs of live cells as soon as they are decoded. Nothing
+// proportional to the pattern is ever kept in memory, so patterns of
+// hundreds of megabytes go straight into the packed board.
+//
+// Loading calls begin(info) once, before any cells, then run(x, y, length)
+// for every run of live cells, with (0, 0) the top-left corner of the
+// pattern. begin() can refuse the pattern by returning false. Errors are
+// printed to stderr with the line they were found on.
+
+struct pattern_info_t
+{
+    int64_t width;
+    int64_t height;
+    char rule[64]; // As written in the file, B3/S23 if it doesn't say
+};
+
+struct pattern_reader_t
+{
+    FILE *file;
+    const char *path;
+    int line;
+    size_t size, pos;
+    char buffer[1 << 16];
+};
+
+inline bool pattern_open(pattern_reader_t *r, const char *path)
+{
+    r->file = fopen(path, "rb");
+    r->path = path;
+    r->line = 1;
+    r->size = r->pos = 0;
+    if (!r->file)
+        fprintf(stderr, "%s: can't open file\n", path);
+    return r->file != nullptr;
+}
+
+inline bool pattern_rewind(pattern_reader_t *r)
+{
+    r->line = 1;
+    r->size = r->pos = 0;
+    return fseek(r->file, 0, SEEK_SET) == 0;
+}
+
+inline int pattern_peek(pattern_reader_t *r)
+{
+    if (r->pos == r->size) {
+        r->size = fread(r->buffer, 1, sizeof(r->buffer), r->file);
+        r->pos = 0;
+        if (r->size == 0)
+            return EOF;
+    }
+    return (unsigned char) r->buffer[r->pos];
+}
+
+inline int pattern_getc(pattern_reader_t *r)
+{
+    const int c = pattern_peek(r);
+    if (c != EOF) {
+        r->pos++;
+        if (c == '\n')
+            r->line++;
+    }
+    return c;
+}
+
+inline void pattern_skip_line(pattern_reader_t *r)
+{
+    int c;
+    do {
+        c = pattern_getc(r);
+    } while (c != '\n' && c != EOF);
+}
+
+// Reads the rest of a line, cut to the buffer size
+inline void pattern_read_line(pattern_reader_t *r, char *line, size_t size)
+{
+    size_t n = 0;
+    for (int c = pattern_getc(r); c != '\n' && c != EOF; c = pattern_getc(r))
+        if (c != '\r' && n + 1 < size)
+            line[n++] = c;
+    line[n] = 0;
+}
+
+inline bool pattern_error(pattern_reader_t *r, const char *message)
+{
+    fprintf(stderr, "%s:%d: %s\n", r->path, r->line, message);
+    return false;
+}
+
+// Optional sign, then digits. Skips spaces and tabs before it. Fails on
+// numbers that don't fit in 64 bits too.
+inline bool pattern_read_int(pattern_reader_t *r, int64_t &value)
+{
+    int c = pattern_peek(r);
+    while (c == ' ' || c == '\t') {
+        pattern_getc(r);
+        c = pattern_peek(r);
+    }
+    const bool negative = c == '-';
+    if (c == '-' || c == '+') {
+        pattern_getc(r);
+        c = pattern_peek(r);
+    }
+    if (c < '0' || c > '9')
+        return false;
+    value = 0;
+    for (; c >= '0' && c <= '9'; c = pattern_peek(r)) {
+        if (value > (INT64_MAX - (c - '0')) / 10)
+            return false;
+        value = value * 10 + (c - '0');
+        pattern_getc(r);
+    }
+    if (negative)
+        value = -value;
+    return true;
+}
+
+// RLE: '#' comment lines, a header "x = 3, y = 3, rule = B3/S23", then runs
+// of 'b' (dead), 'o' (alive) and '$' (end of row) with optional counts,
+// ending with '!'
+template <typename Begin, typename Run>
+bool pattern_load_rle(pattern_reader_t *r, const Begin &begin, const Run &run)
+{
+    pattern_info_t info = { 0, 0, "B3/S23" };
+    char line[256];
+    for (;;) {
+        const int c = pattern_peek(r);
+        if (c == EOF)
+            return pattern_error(r, "missing RLE header");
+        if (c == '#' || c == '\n' || c == '\r') {
+            pattern_skip_line(r);
+            continue;
+        }
+        pattern_read_line(r, line, sizeof(line));
+        break;
+    }
+    long long width, height;
+    if (sscanf(line, " x = %lld , y = %lld", &width, &height) != 2 || width < 0 || height < 0)
+        return pattern_error(r, "bad RLE header");
+    info.width = width;
+    info.height = height;
+    if (const char *rule = strstr(line, "rule")) {
+        rule = strchr(rule, '=');
+        if (rule && sscanf(rule + 1, " %63[^ ,\t]", info.rule) != 1)
+            return pattern_error(r, "bad rule in RLE header");
+    }
+    if (!begin(info))
+        return false;
+
+    int64_t x = 0, y = 0, count = 0;
+    for (;;) {
+        const int c = pattern_getc(r);
+        if (c >= '0' && c <= '9') {
+            // No run is longer than the pattern, which also keeps the count
+            // from overflowing
+            const int64_t longest = std::max(info.width, info.height);
+            if (count > longest / 10 || count * 10 > longest - (c - '0'))
+                return pattern_error(r, "run longer than the pattern in RLE data");
+            count = count * 10 + (c - '0');
+            continue;
+        }
+        const int64_t n = count ? count : 1;
+        count = 0;
+        if (c == 'b' || c == '.') {
+            x += n;
+        } else if (c == '$') {
+            x = 0;
+            y += n;
+        } else if (c == '!') {
+            return true;
+        } else if ((c >= 'p' && c <= 'y')) {
+            // Prefix of a multi-state cell, the letter after it is the state
+            count = n == 1 ? 0 : n;
+        } else if (c == 'o' || (c >= 'A' && c <= 'X')) {
+            run(x, y, n);
+            x += n;
+        } else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            count = n == 1 ? 0 : n;
+        } else if (c == EOF) {
+            // Many files in the wild lack the final '!'
+            return true;
+        } else {
+            return pattern_error(r, "unexpected character in RLE data");
+        }
+    }
+}
+
+// Life 1.06: a "#Life 1.06" line, then one "x y" line per live cell.
+// Coordinates may be negative and come in any order, so a first pass finds
+// the bounding box and a second one hands out the cells.
+template <typename Begin, typename Run>
+bool pattern_load_life106(pattern_reader_t *r, const Begin &begin, const Run &run)
+{
+    int64_t x0 = INT64_MAX, y0 = INT64_MAX, x1 = INT64_MIN, y1 = INT64_MIN;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (;;) {
+            const int c = pattern_peek(r);
+            if (c == EOF)
+                break;
+            if (c == '#' || c == '\n' || c == '\r') {
+                pattern_skip_line(r);
+                continue;
+            }
+            int64_t x, y;
+            if (!pattern_read_int(r, x) || !pattern_read_int(r, y))
+                return pattern_error(r, "expected cell coordinates");
+            pattern_skip_line(r);
+            if (pass == 0) {
+                x0 = std::min(x0, x);
+                y0 = std::min(y0, y);
+                x1 = std::max(x1, x + 1);
+                y1 = std::max(y1, y + 1);
+            } else {
+                run(x - x0, y - y0, 1);
+            }
+        }
+
+        if (pass == 0) {
+            pattern_info_t info = { 0, 0, "B3/S23" };
+            if (x0 < x1) {
+                info.width = x1 - x0;
+                info.height = y1 - y0;
+            }
+            if (!begin(info))
+                return false;
+            if (!pattern_rewind(r))
+                return pattern_error(r, "can't read the file twice");
+        }
+    }
+    return true;
+}
+
+// Loads an RLE or a Life 1.06 file, telling them apart by the first line
+template <typename Begin, typename Run>
+bool pattern_load(const char *path, const Begin &begin, const Run &run)
+{
+    pattern_reader_t reader;
+    pattern_reader_t *r = &reader;
+    if (!pattern_open(r, path))
+        return false;
+    char magic[11] = { 0 };
+    const size_t n = fread(magic, 1, sizeof(magic) - 1, r->file);
+    pattern_rewind(r);
+    const bool life106 = n == 10 && strcmp(magic, "#Life 1.06") == 0;
+    const bool ok = life106 ? pattern_load_life106(r, begin, run) : pattern_load_rle(r, begin, run);
+    fclose(r->file);
+    return ok;
+}
+
+// Lowercase extension .lif or .life saves Life 1.06, anything else RLE
+inline bool pattern_is_life106(const char *path)
+{
+    const char *dot = strrchr(path, '.');
+    return dot && (strcmp(dot, ".lif") == 0 || strcmp(dot, ".life") == 0);
+}
+
+// Output goes through a fixed buffer as well, numbers are formatted by hand
+struct pattern_writer_t
+{
+    FILE *file;
+    int column; // RLE lines are kept under 70 characters
+    size_t size;
+    char buffer[1 << 16];
+};
+
+inline void pattern_flush(pattern_writer_t *w)
+{
+    fwrite(w->buffer, 1, w->size, w->file);
+    w->size = 0;
+}
+
+inline void pattern_write(pattern_writer_t *w, const char *text, size_t n)
+{
+    if (w->size + n > sizeof(w->buffer))
+        pattern_flush(w);
+    memcpy(w->buffer + w->size, text, n);
+    w->size += n;
+}
+
+// Formats a number at the end of `text`, returns where it starts
+inline char *pattern_format(int64_t value, char *end)
+{
+    const bool negative = value < 0;
+    uint64_t v = negative ? 0 - uint64_t(value) : uint64_t(value);
+    do {
+        *--end = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    if (negative)
+        *--end = '-';
+    return end;
+}
+
+// RLE token: a tag with a count unless it is 1
+inline void pattern_put(pattern_writer_t *w, int64_t count, char tag)
+{
+    char token[32];
+    char *end = token + sizeof(token);
+    *--end = tag;
+    const char *start = count > 1 ? pattern_format(count, end) : end;
+    const int n = int(token + sizeof(token) - start);
+    if (w->column + n > 70) {
+        pattern_write(w, "\n", 1);
+        w->column = 0;
+    }
+    pattern_write(w, start, n);
+    w->column += n;
+}
+
+// Life 1.06 line
+inline void pattern_put_cell(pattern_writer_t *w, int64_t x, int64_t y)
+{
+    char line[48];
+    char *end = line + sizeof(line);
+    *--end = '\n';
+    char *start = pattern_format(y, end);
+    *--start = ' ';
+    start = pattern_format(x, start);
+    pattern_write(w, start, line + sizeof(line) - start);
+}
+
+// Writes cells [0, width) x [0, height), row(y) returns packed words of row
+// y with nothing set past the width. The rows are scanned a word at a time.
+template <typename Row>
+bool pattern_save(const char *path, int64_t width, int64_t height, const char *rule, const Row &row)
+{
+    pattern_writer_t writer;
+    pattern_writer_t *w = &writer;
+    w->file = fopen(path, "wb");
+    w->column = 0;
+    w->size = 0;
+    if (!w->file) {
+        fprintf(stderr, "%s: can't create file\n", path);
+        return false;
+    }
+    const bool life106 = pattern_is_life106(path);
+    char header[128];
+    if (life106)
+        snprintf(header, sizeof(header), "#Life 1.06\n");
+    else
+        snprintf(header, sizeof(header), "x = %lld, y = %lld, rule = %s\n",
+                 (long long) width, (long long) height, rule);
+    pattern_write(w, header, strlen(header));
+
+    // Rows without live cells are written as a count of the next '$'
+    int64_t rows = 0;
+    for (int64_t y = 0; y < height; ++y) {
+        const uint64_t *cells = row(y);
+        int64_t x = 0;
+        bool started = false;
+        while (x < width) {
+            // Find the end of the run of cells equal to cell x
+            const bool alive = life_get(cells, x);
+            int64_t end = x;
+            for (;;) {
+                const uint64_t word = (alive ? ~cells[end >> 6] : cells[end >> 6]) >> (end & 63);
+                if (word) {
+                    end += life_ctz(word);
+                    break;
+                }
+                end = (end | 63) + 1;
+                if (end >= width)
+                    break;
+            }
+            end = std::min(end, width);
+            if (!alive && end == width)
+                break;
+
+            if (life106) {
+                if (alive)
+                    for (int64_t i = x; i < end; ++i)
+                        pattern_put_cell(w, i, y);
+            } else {
+                if (!started && rows) {
+                    pattern_put(w, rows, '$');
+                    rows = 0;
+                }
+                pattern_put(w, end - x, alive ? 'o' : 'b');
+            }
+            started = true;
+            x = end;
+        }
+        rows++;
+    }
+    if (!life106) {
+        pattern_put(w, 1, '!');
+        pattern_write(w, "\n", 1);
+    }
+    pattern_flush(w);
+
+    const bool ok = !ferror(w->file);
+    if (fclose(w->file) != 0 || !ok) {
+        fprintf(stderr, "%s: can't write file\n", path);
+        return false;
+    }
+    return true;
+}
+
+#endif // PATTERN_HPP
@@ -0,0 +1,117 @@
+#ifndef RULE_HPP
+#define RULE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// Outer-totalistic two-state rules in B/S notation: a dead cell is born
+// with a number of live neighbours from the B list, a live cell survives
+// with a number from the S list. Bit k of a mask stands for k neighbours.
+//
+// Rules with B0 would turn the whole dead plane alive every other step,
+// which neither the sparse universe nor Hashlife can represent, so they are
+// not accepted.
+
+struct life_rule_t
+{
+    uint16_t birth;
+    uint16_t survive;
+};
+
+inline bool operator==(const life_rule_t &a, const life_rule_t &b)
+{
+    return a.birth == b.birth && a.survive == b.survive;
+}
+
+inline bool operator!=(const life_rule_t &a, const life_rule_t &b)
+{
+    return !(a == b);
+}
+
+// Mask of a list of neighbour counts, like "23"
+constexpr uint16_t life_mask(const char *digits)
+{
+    uint16_t mask = 0;
+    for (; *digits; ++digits)
+        mask |= 1 << (*digits - '0');
+    return mask;
+}
+
+constexpr life_rule_t LIFE_CONWAY = { life_mask("3"), life_mask("23") };
+
+struct life_named_rule_t
+{
+    const char *name;
+    const char *rule;
+};
+
+// Rules the game cycles through, the first ones have specialized kernels
+const life_named_rule_t LIFE_RULES[] = {
+    { "Life", "B3/S23" },
+    { "HighLife", "B36/S23" },
+    { "Day & Night", "B3678/S34678" },
+    { "Seeds", "B2/S" },
+    { "Life without Death", "B3/S012345678" },
+    { "Maze", "B3/S12345" },
+    { "2x2", "B36/S125" },
+    { "Replicator", "B1357/S1357" },
+    { "Morley", "B368/S245" },
+    { "Diamoeba", "B35678/S5678" },
+};
+const int LIFE_RULE_COUNT = sizeof(LIFE_RULES) / sizeof(LIFE_RULES[0]);
+
+// Parses "B3/S23", "S23/B3" or the older "23/3" (survival first), in any
+// case. Anything after a ':' (Golly's topology suffix) is ignored.
+inline bool life_parse_rule(const char *text, life_rule_t &rule)
+{
+    life_rule_t result = { 0, 0 };
+    // 'B' or 'S' of the current list, 0 before the first letter
+    char list = 0;
+    bool lettered = false;
+    int slashes = 0;
+    for (const char *c = text; *c && *c != ':'; ++c) {
+        if (*c == 'B' || *c == 'b') {
+            list = 'B';
+            lettered = true;
+        } else if (*c == 'S' || *c == 's') {
+            list = 'S';
+            lettered = true;
+        } else if (*c == '/') {
+            if (++slashes > 1)
+                return false;
+            // Without letters the first list is survival, the second birth
+            if (!lettered)
+                list = 'B';
+        } else if (*c >= '0' && *c <= '8') {
+            if (list == 'B')
+                result.birth |= 1 << (*c - '0');
+            else if (list == 'S' || (!lettered && slashes == 0))
+                result.survive |= 1 << (*c - '0');
+            else
+                return false;
+        } else {
+            return false;
+        }
+    }
+    if (result.birth & 1)
+        return false;
+    rule = result;
+    return true;
+}
+
+inline void life_format_rule(const life_rule_t &rule, char *text, size_t size)
+{
+    char birth[10], survive[10];
+    int b = 0, s = 0;
+    for (int k = 0; k <= 8; ++k) {
+        if ((rule.birth >> k) & 1)
+            birth[b++] = '0' + k;
+        if ((rule.survive >> k) & 1)
+            survive[s++] = '0' + k;
+    }
+    birth[b] = survive[s] = 0;
+    snprintf(text, size, "B%s/S%s", birth, survive);
+}
+
+#endif // RULE_HPP
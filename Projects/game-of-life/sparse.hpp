@@ -0,0 +1,355 @@
+#ifndef SPARSE_HPP
+#define SPARSE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "life.hpp"
+
+// Sparse universe: the unbounded plane is cut into 64x64 chunks, one packed
+// word per chunk row, kept in a hash map by chunk coordinates. A missing
+// chunk is dead. Only chunks that changed in the last generation and their
+// neighbours can change in the next one, so only those are stepped, and
+// chunks that die out are freed. The cost of a step follows the activity of
+// the pattern, not the area it spans.
+
+const int SPARSE_CHUNK = 64;
+
+struct sparse_chunk_t
+{
+    uint64_t rows[SPARSE_CHUNK];
+    uint64_t next[SPARSE_CHUNK]; // Next generation, valid during the step
+    // Live cells of the chunk, [x0, x1) x [y0, y1), empty when x0 >= x1,
+    // and how many there are. Updated whenever rows change, so the bounds
+    // of the universe and a zoomed-out view need no pass over the rows.
+    int x0, y0, x1, y1;
+    int population;
+};
+
+// Chunk coordinates, whole: cells go as far as 64-bit coordinates do, which
+// Hashlife jumps can reach
+struct sparse_key_t
+{
+    int64_t x, y;
+    bool operator==(const sparse_key_t &other) const { return x == other.x && y == other.y; }
+};
+
+// Buckets are taken modulo a prime, a multiply is enough to mix x into y
+struct sparse_key_hash
+{
+    size_t operator()(const sparse_key_t &key) const
+    {
+        return size_t(uint64_t(key.x) * 0x9E3779B97F4A7C15ull ^ uint64_t(key.y));
+    }
+};
+
+struct sparse_t
+{
+    std::unordered_map<sparse_key_t, sparse_chunk_t *, sparse_key_hash> chunks;
+    // Chunks that changed in the last generation or were edited
+    std::unordered_set<sparse_key_t, sparse_key_hash> active;
+    // Freed chunks, reused before allocating new ones
+    std::vector<sparse_chunk_t *> pool;
+    // Scratch set of chunks stepped in the current generation
+    std::unordered_set<sparse_key_t, sparse_key_hash> candidates;
+};
+
+inline sparse_key_t sparse_key(int64_t cx, int64_t cy)
+{
+    return { cx, cy };
+}
+
+inline int64_t sparse_key_x(const sparse_key_t &key)
+{
+    return key.x;
+}
+
+inline int64_t sparse_key_y(const sparse_key_t &key)
+{
+    return key.y;
+}
+
+inline sparse_chunk_t *sparse_find(const sparse_t *s, sparse_key_t key)
+{
+    auto it = s->chunks.find(key);
+    return it == s->chunks.end() ? nullptr : it->second;
+}
+
+// Bounds and population of a chunk from its rows
+inline void sparse_chunk_bounds(sparse_chunk_t *chunk)
+{
+    uint64_t columns = 0;
+    chunk->y0 = SPARSE_CHUNK;
+    chunk->y1 = 0;
+    chunk->population = 0;
+    for (int y = 0; y < SPARSE_CHUNK; ++y) {
+        if (!chunk->rows[y])
+            continue;
+        columns |= chunk->rows[y];
+        chunk->population += life_popcount(chunk->rows[y]);
+        chunk->y0 = std::min(chunk->y0, y);
+        chunk->y1 = y + 1;
+    }
+    chunk->x0 = columns ? life_ctz(columns) : SPARSE_CHUNK;
+    chunk->x1 = columns ? life_msb(columns) + 1 : 0;
+}
+
+inline sparse_chunk_t *sparse_create(sparse_t *s, sparse_key_t key)
+{
+    sparse_chunk_t *chunk;
+    if (!s->pool.empty()) {
+        chunk = s->pool.back();
+        s->pool.pop_back();
+    } else {
+        chunk = new sparse_chunk_t;
+    }
+    memset(chunk->rows, 0, sizeof(chunk->rows));
+    sparse_chunk_bounds(chunk);
+    s->chunks.emplace(key, chunk);
+    return chunk;
+}
+
+inline bool sparse_get(const sparse_t *s, int64_t x, int64_t y)
+{
+    // Shifts round towards negative infinity, so negative cells land in
+    // the chunk to the left/above, at a non-negative offset
+    const sparse_chunk_t *chunk = sparse_find(s, sparse_key(x >> 6, y >> 6));
+    return chunk && life_get(&chunk->rows[y & 63], x & 63);
+}
+
+inline void sparse_set(sparse_t *s, int64_t x, int64_t y, bool alive)
+{
+    const sparse_key_t key = sparse_key(x >> 6, y >> 6);
+    sparse_chunk_t *chunk = sparse_find(s, key);
+    if (!chunk) {
+        if (!alive)
+            return;
+        chunk = sparse_create(s, key);
+    }
+    if (alive && !life_get(&chunk->rows[y & 63], x & 63))
+        chunk->population++;
+    life_set(&chunk->rows[y & 63], x & 63, alive);
+    if (alive) {
+        chunk->x0 = std::min(chunk->x0, int(x & 63));
+        chunk->y0 = std::min(chunk->y0, int(y & 63));
+        chunk->x1 = std::max(chunk->x1, int(x & 63) + 1);
+        chunk->y1 = std::max(chunk->y1, int(y & 63) + 1);
+    } else {
+        sparse_chunk_bounds(chunk);
+    }
+    // Neighbours have to be looked at in the next step. A chunk cleared by
+    // hand is freed there too.
+    s->active.insert(key);
+}
+
+// Packs cells [x0, x0 + width) of row y into `out`, life_words(width) words
+inline void sparse_read_row(const sparse_t *s, int64_t x0, int64_t y, int64_t width, uint64_t *out)
+{
+    const int64_t words = (width + 63) / 64;
+    memset(out, 0, words * sizeof(uint64_t));
+    for (int64_t cx = x0 >> 6; cx <= (x0 + width - 1) >> 6; ++cx) {
+        const sparse_chunk_t *chunk = sparse_find(s, sparse_key(cx, y >> 6));
+        if (!chunk)
+            continue;
+        const uint64_t w = chunk->rows[y & 63];
+        // Offset of the first cell of the chunk in the output row
+        const int64_t offset = cx * SPARSE_CHUNK - x0;
+        if (offset < 0) {
+            out[0] |= w >> -offset;
+            continue;
+        }
+        out[offset >> 6] |= w << (offset & 63);
+        if ((offset & 63) && (offset >> 6) + 1 < words)
+            out[(offset >> 6) + 1] |= w >> (64 - (offset & 63));
+    }
+    if (width % 64)
+        out[words - 1] &= (uint64_t(1) << (width % 64)) - 1;
+}
+
+inline void sparse_clear(sparse_t *s)
+{
+    for (auto &it : s->chunks)
+        s->pool.push_back(it.second);
+    s->chunks.clear();
+    s->active.clear();
+}
+
+inline void sparse_destroy(sparse_t *s)
+{
+    sparse_clear(s);
+    for (sparse_chunk_t *chunk : s->pool)
+        delete chunk;
+    s->pool.clear();
+}
+
+// Next state of the chunk at (cx, cy), which may be missing. Returns
+// whether anything is alive in it.
+inline bool sparse_step_chunk(const sparse_t *s, int64_t cx, int64_t cy,
+                              life_row_kernel kernel, const life_rule_t &rule, uint64_t *out)
+{
+    // The chunk with a halo: the last row of the chunks above, the first row
+    // of the chunks below, and whole words of the chunks on the sides, so
+    // that the row kernel can read its guard words
+    uint64_t grid[SPARSE_CHUNK + 2][3];
+    bool any = false;
+    for (int dy = -1; dy <= 1; ++dy) {
+        for (int dx = -1; dx <= 1; ++dx) {
+            const sparse_chunk_t *chunk = sparse_find(s, sparse_key(cx + dx, cy + dy));
+            any |= chunk != nullptr;
+            const int first = dy < 0 ? SPARSE_CHUNK - 1 : 0;
+            const int last = dy > 0 ? 0 : SPARSE_CHUNK - 1;
+            const int to = dy < 0 ? 0 : dy == 0 ? 1 : SPARSE_CHUNK + 1;
+            for (int y = first; y <= last; ++y)
+                grid[to + y - first][dx + 1] = chunk ? chunk->rows[y] : 0;
+        }
+    }
+    if (!any)
+        return false;
+
+    uint64_t alive = 0;
+    for (int y = 1; y <= SPARSE_CHUNK; ++y) {
+        kernel(rule, &grid[y - 1][1], &grid[y][1], &grid[y + 1][1], &out[y - 1], 1, ~uint64_t(0));
+        alive |= out[y - 1];
+    }
+    return alive != 0;
+}
+
+// Hash of the cells, see life_word_hash()
+inline uint64_t sparse_hash(const sparse_t *s)
+{
+    uint64_t hash = 0;
+    for (auto &it : s->chunks) {
+        const int64_t cx = sparse_key_x(it.first), cy = sparse_key_y(it.first);
+        for (int y = 0; y < SPARSE_CHUNK; ++y)
+            hash ^= life_word_hash(cx, cy * SPARSE_CHUNK + y, it.second->rows[y]);
+    }
+    return hash;
+}
+
+// Bounding box of the live cells from those of the chunks, a few
+// comparisons per chunk
+inline void sparse_add_bounds(const sparse_t *s, life_stats_t &stats)
+{
+    for (auto &it : s->chunks) {
+        const sparse_chunk_t *chunk = it.second;
+        if (chunk->x0 >= chunk->x1)
+            continue;
+        const int64_t cx = sparse_key_x(it.first) * SPARSE_CHUNK;
+        const int64_t cy = sparse_key_y(it.first) * SPARSE_CHUNK;
+        life_stats_add_bounds(stats, cx + chunk->x0, cy + chunk->y0, cx + chunk->x1, cy + chunk->y1);
+    }
+}
+
+// Population and bounding box of the cells, no births or deaths
+inline life_stats_t sparse_stats(const sparse_t *s)
+{
+    life_stats_t stats;
+    life_stats_empty_bounds(stats);
+    for (auto &it : s->chunks)
+        stats.population += it.second->population;
+    sparse_add_bounds(s, stats);
+    return stats;
+}
+
+// The kernel is life_select_row_kernel(rule, false): chunk rows are a
+// single word, not padded for the vector kernels. If `hash` isn't null, it
+// goes from sparse_hash() of this generation to that of the next one, and
+// `stats` from sparse_stats() or the last step to the stats of this one.
+// Its bounds grow from the chunks that changed, all chunks are gone over
+// only when one of them pulled back from an edge.
+inline void sparse_step(sparse_t *s, life_row_kernel kernel, const life_rule_t &rule,
+                        uint64_t *hash = nullptr, life_stats_t *stats = nullptr)
+{
+    s->candidates.clear();
+    for (sparse_key_t key : s->active) {
+        const int64_t cx = sparse_key_x(key), cy = sparse_key_y(key);
+        for (int dy = -1; dy <= 1; ++dy)
+            for (int dx = -1; dx <= 1; ++dx)
+                s->candidates.insert(sparse_key(cx + dx, cy + dy));
+    }
+
+    // Compute every candidate from the current generation. Chunks born in
+    // this step are created dead, so they read the same as missing ones.
+    uint64_t next[SPARSE_CHUNK];
+    for (sparse_key_t key : s->candidates) {
+        const bool alive = sparse_step_chunk(s, sparse_key_x(key), sparse_key_y(key), kernel, rule, next);
+        sparse_chunk_t *chunk = sparse_find(s, key);
+        if (!chunk) {
+            if (!alive)
+                continue;
+            chunk = sparse_create(s, key);
+        }
+        memcpy(chunk->next, next, sizeof(next));
+    }
+
+    // Commit, remembering what changed for the next step
+    s->active.clear();
+    bool rescan = false;
+    if (stats)
+        stats->births = stats->deaths = 0;
+    for (sparse_key_t key : s->candidates) {
+        auto it = s->chunks.find(key);
+        if (it == s->chunks.end())
+            continue;
+        sparse_chunk_t *chunk = it->second;
+        if (memcmp(chunk->rows, chunk->next, sizeof(chunk->rows)) != 0) {
+            const int64_t cx = sparse_key_x(key), cy = sparse_key_y(key);
+            for (int y = 0; y < SPARSE_CHUNK; ++y) {
+                if (chunk->rows[y] == chunk->next[y])
+                    continue;
+                if (hash)
+                    *hash ^= life_word_hash(cx, cy * SPARSE_CHUNK + y, chunk->rows[y]) ^
+                             life_word_hash(cx, cy * SPARSE_CHUNK + y, chunk->next[y]);
+                if (stats)
+                    life_stats_add_change(*stats, chunk->rows[y], chunk->next[y]);
+            }
+            memcpy(chunk->rows, chunk->next, sizeof(chunk->rows));
+            const int x0 = chunk->x0, y0 = chunk->y0, x1 = chunk->x1, y1 = chunk->y1;
+            sparse_chunk_bounds(chunk);
+            s->active.insert(key);
+            if (stats) {
+                const int64_t left = cx * SPARSE_CHUNK, top = cy * SPARSE_CHUNK;
+                const bool empty = chunk->x0 >= chunk->x1;
+                if (x0 < x1 && ((left + x0 == stats->x0 && (empty || chunk->x0 > x0)) ||
+                                (top + y0 == stats->y0 && (empty || chunk->y0 > y0)) ||
+                                (left + x1 == stats->x1 && (empty || chunk->x1 < x1)) ||
+                                (top + y1 == stats->y1 && (empty || chunk->y1 < y1))))
+                    rescan = true;
+                if (!empty)
+                    life_stats_add_bounds(*stats, left + chunk->x0, top + chunk->y0,
+                                          left + chunk->x1, top + chunk->y1);
+            }
+        }
+
+        if (chunk->x0 >= chunk->x1) {
+            s->pool.push_back(chunk);
+            s->chunks.erase(it);
+        }
+    }
+    if (stats) {
+        stats->population += stats->births - stats->deaths;
+        if (rescan) {
+            life_stats_empty_bounds(*stats);
+            sparse_add_bounds(s, *stats);
+        }
+    }
+}
+
+// Bounding box of live cells as [x0, x1) x [y0, y1). Returns false if the
+// universe is empty.
+inline bool sparse_bounds(const sparse_t *s, int64_t &x0, int64_t &y0, int64_t &x1, int64_t &y1)
+{
+    life_stats_t stats;
+    life_stats_empty_bounds(stats);
+    sparse_add_bounds(s, stats);
+    x0 = stats.x0;
+    y0 = stats.y0;
+    x1 = stats.x1;
+    y1 = stats.y1;
+    return x0 < x1;
+}
+
+#endif // SPARSE_HPP
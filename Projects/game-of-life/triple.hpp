@@ -0,0 +1,56 @@
+#ifndef TRIPLE_HPP
+#define TRIPLE_HPP
+
+#include <atomic>
+
+// Lock-free triple buffer between one writer and one reader thread. The
+// writer fills the back buffer and publishes it, the reader takes the
+// latest published one. Neither ever waits for the other: the third buffer
+// is always free for the writer, and the reader simply keeps its current
+// buffer until a newer one is published. Buffers that are published but
+// never read are overwritten.
+
+// Set in `middle` while it holds a buffer the reader hasn't taken yet
+const int TRIPLE_FRESH = 4;
+
+template <typename T>
+struct triple_buffer_t
+{
+    T buffers[3];
+    // Index of the buffer between the two threads, with TRIPLE_FRESH
+    std::atomic<int> middle { 1 };
+    int back = 0;  // Writer's
+    int front = 2; // Reader's
+};
+
+template <typename T>
+T *triple_back(triple_buffer_t<T> *b)
+{
+    return &b->buffers[b->back];
+}
+
+// Hands the back buffer to the reader, the writer gets the middle one
+template <typename T>
+void triple_publish(triple_buffer_t<T> *b)
+{
+    b->back = b->middle.exchange(b->back | TRIPLE_FRESH, std::memory_order_acq_rel) & 3;
+}
+
+// Takes the latest published buffer if there is a new one, returns whether
+// the front buffer changed
+template <typename T>
+bool triple_acquire(triple_buffer_t<T> *b)
+{
+    if (!(b->middle.load(std::memory_order_relaxed) & TRIPLE_FRESH))
+        return false;
+    b->front = b->middle.exchange(b->front, std::memory_order_acq_rel) & 3;
+    return true;
+}
+
+template <typename T>
+T *triple_front(triple_buffer_t<T> *b)
+{
+    return &b->buffers[b->front];
+}
+
+#endif // TRIPLE_HPP
@@ -7,6 +7,24 @@
 #include <complex>
 #include <vector>
 #include <thread>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <chrono>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+// Declared by hand: windows.h clashes with raylib names
+extern "C" __declspec(dllimport) void *__stdcall GetCurrentThread(void);
+extern "C" __declspec(dllimport) uintptr_t __stdcall SetThreadAffinityMask(void *thread, uintptr_t mask);
+#endif
 
 struct v2d
 {
@@ -19,23 +37,169 @@ struct viewport_t
     long double bottom, top;
 };
 
+enum render_mode_t
+{
+    RENDER_ESCAPE_TIME,
+    RENDER_DISTANCE,
+    RENDER_BUDDHABROT,
+    RENDER_MODE_COUNT,
+};
+
+const char *render_mode_names[RENDER_MODE_COUNT] = {
+    "escape time",
+    "distance",
+    "buddhabrot",
+};
+
+// Escape radius for the distance estimator. The estimate is only accurate
+// once |z| is large, so keep iterating well past 2 before shading.
+const long double DE_BAILOUT = 256;
+
+// Workers render the screen in square tiles and check for a newer render
+// generation between tiles, so a stale render stops within one tile.
+const int TILE_SIZE = 32;
+// Iterations given to every pixel of a tile per visit. The budget doubles
+// on each pass over the screen up to ITERATION_CHUNK << MAX_CHUNK_SHIFT.
+const int ITERATION_CHUNK = 16;
+const int MAX_CHUNK_SHIFT = 4;
+
+// Buddhabrot samples c from [-2, 2] x [-2, 2], which contains every orbit
+// that stays bounded for more than one iteration. Long orbits make the
+// picture, so the domain is split into cells and cells near the set
+// boundary are sampled more often.
+const double BUDDHABROT_DOMAIN = 2;
+const int IMPORTANCE_GRID = 128;
+const int IMPORTANCE_SUBSAMPLES = 3;
+// Sampling weight of a cell with no boundary in it. It must stay positive,
+// otherwise orbits starting in such cells would never be counted.
+const double IMPORTANCE_FLOOR = 0.05;
+const int MIN_BUDDHABROT_ITERATIONS = 1000;
+// Samples between checks for cancellation and for a histogram merge
+const int BUDDHABROT_BATCH = 256;
+const auto MERGE_INTERVAL = std::chrono::milliseconds(100);
+const auto RECOLOR_INTERVAL = std::chrono::milliseconds(250);
+
 struct pixel_data_t
 {
     std::complex<long double> z;
+    std::complex<long double> dz;
     std::complex<long double> c;
     int iteration;
     Color color;
     bool done;
 };
 
+struct tile_t
+{
+    int x0, y0;
+    int x1, y1;
+    // Worker that first-touches this tile and renders it first
+    int owner;
+    // Generation the pixels of this tile were initialized for. Tiles are
+    // reset lazily by the worker that picks them up first.
+    uint64_t generation;
+    bool active;
+    int resolved;
+    std::mutex lock;
+};
+
+// Tiles are dealt to workers round-robin. A worker renders its own tiles
+// and only steals from others once all of its tiles are done.
+struct alignas(64) worker_t
+{
+    std::thread thread;
+    std::vector<int> tiles;
+    std::atomic<uint64_t> next_ticket;
+    std::atomic<int> active_tiles;
+
+    // Buddhabrot visit counts, merged into context_t::density from time to
+    // time so that splatting an orbit never touches shared memory
+    std::vector<float> histogram;
+    std::vector<double> orbit;
+    std::mt19937_64 rng;
+
+    // Counters for the statistics overlay, written only by this worker
+    std::atomic<uint64_t> iterations;
+    std::atomic<uint64_t> busy_ns;
+    std::atomic<uint64_t> iterate_ns;
+    std::atomic<uint64_t> color_ns;
+};
+
+// Cumulative counters at one moment; rates come from two snapshots
+struct stats_t
+{
+    uint64_t time_ns;
+    uint64_t iterations;
+    uint64_t iterate_ns;
+    uint64_t color_ns;
+    uint64_t upload_ns;
+    std::vector<uint64_t> busy_ns;
+};
+
+struct stats_report_t
+{
+    double iterations_per_second;
+    double resolved;
+    int queued_tiles;
+    // Milliseconds spent per second of wall time, summed over threads
+    double iterate_ms;
+    double color_ms;
+    double upload_ms;
+    // Fraction of wall time each worker spent rendering
+    std::vector<double> busy;
+};
+
+const uint64_t STATS_INTERVAL_NS = 1000000000;
+
 struct context_t
 {
     Vector2 screen_size;
     viewport_t viewport;
     int max_iterations;
-    std::vector<std::vector<pixel_data_t>> pixel_data;
+    render_mode_t mode;
+    // Tile-major: every tile owns TILE_SIZE * TILE_SIZE consecutive pixels,
+    // so its pages can be placed on the NUMA node of the owning worker
+    pixel_data_t *pixel_data;
+
+    // Row-major colors, published by workers tile by tile
+    std::vector<Color> image;
+    std::mutex image_lock;
+
+    // Buddhabrot density accumulated over all workers
+    std::vector<float> density;
+    std::vector<double> importance_cdf;
+    int importance_iterations;
+    // A worker is building a new importance map, the others wait on
+    // importance_cv
+    bool importance_building;
+    std::condition_variable importance_cv;
+    std::chrono::steady_clock::time_point last_recolor;
+    std::mutex density_lock;
+
+    std::vector<tile_t> tiles;
+    std::vector<worker_t> workers;
+    bool pin_workers;
+    // Bumped to cancel the current render. Workers compare it against the
+    // generation they started with after every tile.
+    std::atomic<uint64_t> generation;
+    std::atomic<int> active_tiles;
+    std::atomic<int> resolved_pixels;
+    // Time the main thread spent copying and uploading frames
+    uint64_t upload_ns;
+    std::mutex lock;
+    std::condition_variable cv;
+    uint64_t started;
+    int parked;
+    bool quit;
 };
 
+uint64_t
+now_ns()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
 v2d
 screen_to_local(context_t *ctx, v2d point)
 {
@@ -56,17 +220,36 @@ f(double x, double q, double p)
     return uint8_t(255.0 * a * a);
 }
 
-void
-iterate(context_t *ctx, pixel_data_t *pixel_data)
+long double
+pixel_size(context_t *ctx)
 {
-    if (pixel_data->done) return;
+    return std::abs(ctx->viewport.right - ctx->viewport.left) / ctx->screen_size.x;
+}
 
-    auto z = pixel_data->z;
-    auto c = pixel_data->c;
-    pixel_data->z = z * z + c;
+// z = z^2 + c written out by hand, std::complex multiplication goes through
+// a slow NaN-aware library call. Every mode iterates with it: pixels in
+// long double for deep zooms, Buddhabrot orbits in double, which is plenty
+// for the fixed [-2, 2] domain and much faster.
+template <typename T>
+inline void
+mandelbrot_step(T &x, T &y, T cx, T cy)
+{
+    T xx = x * x;
+    T yy = y * y;
+    y = 2 * x * y + cy;
+    x = xx - yy + cx;
+}
+
+void
+iterate_escape_time(pixel_data_t *pixel_data)
+{
+    long double x = pixel_data->z.real(), y = pixel_data->z.imag();
+    const long double radius2 = x * x + y * y;
+    mandelbrot_step(x, y, pixel_data->c.real(), pixel_data->c.imag());
+    pixel_data->z = { x, y };
     pixel_data->iteration++;
 
-    if (std::abs(z) > 2)
+    if (radius2 > 4)
     {
         int i = pixel_data->iteration;
         pixel_data->color = Color { 
@@ -74,6 +257,50 @@ iterate(context_t *ctx, pixel_data_t *pixel_data)
         };
         pixel_data->done = true;
     }
+}
+
+void
+iterate_distance(context_t *ctx, pixel_data_t *pixel_data)
+{
+    long double x = pixel_data->z.real(), y = pixel_data->z.imag();
+    const long double dx = pixel_data->dz.real(), dy = pixel_data->dz.imag();
+    // dz is the derivative of z with respect to c: dz' = 2 * z * dz + 1
+    pixel_data->dz = { 2 * (x * dx - y * dy) + 1, 2 * (x * dy + y * dx) };
+    mandelbrot_step(x, y, pixel_data->c.real(), pixel_data->c.imag());
+    pixel_data->z = { x, y };
+    pixel_data->iteration++;
+
+    long double r = std::abs(pixel_data->z);
+    if (r <= 2) return;
+
+    long double size = pixel_size(ctx);
+    long double distance = 0.5L * r * log(r) / std::abs(pixel_data->dz);
+    // Once the point is closer to the set than a pixel, further iterations
+    // can't change how it looks, so shade it as boundary right away.
+    if (distance < size || r > DE_BAILOUT)
+    {
+        long double t = std::min(distance / (4 * size), 1.0L);
+        uint8_t v = uint8_t(255.0 * pow(double(t), 0.25));
+        pixel_data->color = Color { v, v, v, 255 };
+        pixel_data->done = true;
+    }
+}
+
+void
+iterate(context_t *ctx, pixel_data_t *pixel_data)
+{
+    if (pixel_data->done) return;
+
+    switch (ctx->mode)
+    {
+    case RENDER_DISTANCE:
+        iterate_distance(ctx, pixel_data);
+        break;
+    default:
+        iterate_escape_time(pixel_data);
+        break;
+    }
+
     if (pixel_data->iteration >= ctx->max_iterations)
         pixel_data->done = true;
 }
@@ -95,22 +322,572 @@ fix_rect(Rectangle rect)
     return fixed;
 }
 
+pixel_data_t *
+tile_pixels(context_t *ctx, tile_t *tile)
+{
+    return ctx->pixel_data + (tile - ctx->tiles.data()) * TILE_SIZE * TILE_SIZE;
+}
+
+void
+init_tile(context_t *ctx, tile_t *tile)
+{
+    pixel_data_t *pixels = tile_pixels(ctx, tile);
+    for (int y = tile->y0; y < tile->y1; ++y)
+    {
+        for (int x = tile->x0; x < tile->x1; ++x)
+        {
+            v2d point = screen_to_local(ctx, v2d { (long double) x, (long double) y });
+            pixels[(y - tile->y0) * TILE_SIZE + (x - tile->x0)] = pixel_data_t {
+                { 0, 0 }, // z
+                { 0, 0 }, // dz
+                { point.x, point.y }, // c
+                0, // iteration
+                BLACK, // color
+                false, // done
+            };
+        }
+    }
+}
+
+void
+render_tile(context_t *ctx, worker_t *self, worker_t *queue, uint64_t generation, uint64_t ticket)
+{
+    const int ntiles = queue->tiles.size();
+    tile_t *tile = &ctx->tiles[queue->tiles[ticket % ntiles]];
+    const uint64_t pass = ticket / ntiles;
+    // A fast worker may lap a slow one, so the same tile can be handed out
+    // twice at once
+    std::lock_guard<std::mutex> guard(tile->lock);
+
+    if (tile->generation != generation)
+    {
+        init_tile(ctx, tile);
+        tile->generation = generation;
+        tile->active = true;
+        tile->resolved = 0;
+    }
+    if (!tile->active) return;
+
+    const uint64_t start = now_ns();
+    const int budget = ITERATION_CHUNK << std::min<uint64_t>(pass, MAX_CHUNK_SHIFT);
+    pixel_data_t *pixels = tile_pixels(ctx, tile);
+    bool active = false;
+    uint64_t iterations = 0;
+    int resolved = 0;
+    for (int y = tile->y0; y < tile->y1; ++y)
+    {
+        for (int x = tile->x0; x < tile->x1; ++x)
+        {
+            pixel_data_t *pixel = &pixels[(y - tile->y0) * TILE_SIZE + (x - tile->x0)];
+            const int before = pixel->iteration;
+            for (int i = 0; i < budget && !pixel->done; ++i)
+                iterate(ctx, pixel);
+            iterations += pixel->iteration - before;
+            active |= !pixel->done;
+            resolved += pixel->done;
+        }
+    }
+    const uint64_t iterated = now_ns();
+
+    {
+        std::lock_guard<std::mutex> image_guard(ctx->image_lock);
+        const int width = ctx->screen_size.x;
+        for (int y = tile->y0; y < tile->y1; ++y)
+            for (int x = tile->x0; x < tile->x1; ++x)
+                ctx->image[y * width + x] = pixels[(y - tile->y0) * TILE_SIZE + (x - tile->x0)].color;
+    }
+    const uint64_t colored = now_ns();
+
+    self->iterations += iterations;
+    self->iterate_ns += iterated - start;
+    self->color_ns += colored - iterated;
+    ctx->resolved_pixels += resolved - tile->resolved;
+    tile->resolved = resolved;
+
+    if (!active)
+    {
+        tile->active = false;
+        ctx->workers[tile->owner].active_tiles--;
+        ctx->active_tiles--;
+    }
+}
+
+// Main cardioid and period-2 bulb: orbits there never escape
+bool
+in_main_bulbs(double cx, double cy)
+{
+    double q = (cx - 0.25) * (cx - 0.25) + cy * cy;
+    if (q * (q + cx - 0.25) <= 0.25 * cy * cy) return true;
+    return (cx + 1) * (cx + 1) + cy * cy <= 1.0 / 16;
+}
+
+// Traces the orbit of c into orbit[] and returns its length, or 0 if the
+// orbit stays bounded for max_iterations
+int
+trace_orbit(double cx, double cy, int max_iterations, double *orbit)
+{
+    if (in_main_bulbs(cx, cy)) return 0;
+
+    double x = 0, y = 0;
+    for (int i = 0; i < max_iterations; ++i)
+    {
+        mandelbrot_step(x, y, cx, cy);
+        orbit[2 * i] = x;
+        orbit[2 * i + 1] = y;
+        if (x * x + y * y > 4) return i + 1;
+    }
+    return 0;
+}
+
+int
+buddhabrot_iterations(context_t *ctx)
+{
+    return std::max(ctx->max_iterations, MIN_BUDDHABROT_ITERATIONS);
+}
+
+// Weights every cell of the sampling domain by how much of the set boundary
+// it seems to contain. Cells with both escaping and bounded subsamples get
+// the most samples, cells with slowly escaping orbits come next. Gives up,
+// returning false, as soon as the render generation changes.
+bool
+build_importance_map(context_t *ctx, uint64_t generation, int iterations, std::vector<double> &cdf)
+{
+    const double cell = 2 * BUDDHABROT_DOMAIN / IMPORTANCE_GRID;
+    std::vector<double> orbit(2 * iterations);
+
+    cdf.resize(IMPORTANCE_GRID * IMPORTANCE_GRID);
+    double total = 0;
+    for (int j = 0; j < IMPORTANCE_GRID; ++j)
+    {
+        if (ctx->generation != generation) return false;
+        for (int i = 0; i < IMPORTANCE_GRID; ++i)
+        {
+            int escaped = 0;
+            int slow = 0;
+            for (int s = 0; s < IMPORTANCE_SUBSAMPLES * IMPORTANCE_SUBSAMPLES; ++s)
+            {
+                double cx = -BUDDHABROT_DOMAIN + (i + (s % IMPORTANCE_SUBSAMPLES + 0.5) / IMPORTANCE_SUBSAMPLES) * cell;
+                double cy = -BUDDHABROT_DOMAIN + (j + (s / IMPORTANCE_SUBSAMPLES + 0.5) / IMPORTANCE_SUBSAMPLES) * cell;
+                int length = trace_orbit(cx, cy, iterations, orbit.data());
+                if (length > 0) escaped++;
+                if (length > 16) slow++;
+            }
+            const int n = IMPORTANCE_SUBSAMPLES * IMPORTANCE_SUBSAMPLES;
+            bool mixed = escaped > 0 && escaped < n;
+            total += IMPORTANCE_FLOOR + (mixed ? 1.0 : 0.0) + double(slow) / n;
+            cdf[j * IMPORTANCE_GRID + i] = total;
+        }
+    }
+    return true;
+}
+
+// Makes the importance map match the iteration count of the render. The
+// first worker to find it stale builds a new one outside of density_lock
+// and swaps it in, the others wait for it. Returns false if the render is
+// cancelled meanwhile.
+bool
+update_importance_map(context_t *ctx, uint64_t generation)
+{
+    const int iterations = buddhabrot_iterations(ctx);
+    std::unique_lock<std::mutex> lock(ctx->density_lock);
+    ctx->importance_cv.wait(lock, [ctx, generation] {
+        return !ctx->importance_building || ctx->generation != generation;
+    });
+    if (ctx->generation != generation) return false;
+    if (ctx->importance_iterations == iterations) return true;
+
+    ctx->importance_building = true;
+    lock.unlock();
+    std::vector<double> cdf;
+    const bool built = build_importance_map(ctx, generation, iterations, cdf);
+    lock.lock();
+    if (built)
+    {
+        ctx->importance_cdf.swap(cdf);
+        ctx->importance_iterations = iterations;
+    }
+    ctx->importance_building = false;
+    ctx->importance_cv.notify_all();
+    return built;
+}
+
+// Adds the worker's histogram to the shared density and, at most every
+// RECOLOR_INTERVAL, turns the density into the displayed image
+void
+merge_histogram(context_t *ctx, worker_t *self)
+{
+    std::lock_guard<std::mutex> guard(ctx->density_lock);
+    for (size_t i = 0; i < self->histogram.size(); ++i)
+        ctx->density[i] += self->histogram[i];
+    std::fill(self->histogram.begin(), self->histogram.end(), 0.0f);
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - ctx->last_recolor < RECOLOR_INTERVAL) return;
+    ctx->last_recolor = now;
+
+    float max_density = *std::max_element(ctx->density.begin(), ctx->density.end());
+    if (max_density <= 0) return;
+    const float scale = 1 / max_density;
+
+    std::lock_guard<std::mutex> image_guard(ctx->image_lock);
+    for (size_t i = 0; i < ctx->density.size(); ++i)
+    {
+        float t = sqrt(ctx->density[i] * scale);
+        ctx->image[i] = Color {
+            uint8_t(255 * t), uint8_t(235 * t), uint8_t(200 * t), 255
+        };
+    }
+}
+
+// Samples orbits until the render is cancelled. Each orbit is weighted by
+// the inverse of its sampling probability, so importance sampling changes
+// only the noise, not the picture.
+void
+render_buddhabrot(context_t *ctx, worker_t *self, uint64_t generation)
+{
+    if (!update_importance_map(ctx, generation)) return;
+
+    const int width = ctx->screen_size.x;
+    const int height = ctx->screen_size.y;
+    const int max_iterations = buddhabrot_iterations(ctx);
+    const double cell = 2 * BUDDHABROT_DOMAIN / IMPORTANCE_GRID;
+    const double total = ctx->importance_cdf.back();
+    const double ncells = IMPORTANCE_GRID * IMPORTANCE_GRID;
+    const double left = ctx->viewport.left;
+    const double bottom = ctx->viewport.bottom;
+    const double sx = width / double(ctx->viewport.right - ctx->viewport.left);
+    const double sy = height / double(ctx->viewport.top - ctx->viewport.bottom);
+
+    self->histogram.assign(width * height, 0.0f);
+    self->orbit.resize(2 * max_iterations);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    auto last_merge = std::chrono::steady_clock::now();
+
+    while (ctx->generation == generation)
+    {
+        const uint64_t start = now_ns();
+        uint64_t iterations = 0;
+        for (int n = 0; n < BUDDHABROT_BATCH; ++n)
+        {
+            auto it = std::upper_bound(ctx->importance_cdf.begin(), ctx->importance_cdf.end(), uniform(self->rng) * total);
+            int index = std::min<int>(it - ctx->importance_cdf.begin(), ncells - 1);
+            double weight = index > 0 ? ctx->importance_cdf[index] - ctx->importance_cdf[index - 1] : ctx->importance_cdf[0];
+
+            double cx = -BUDDHABROT_DOMAIN + (index % IMPORTANCE_GRID + uniform(self->rng)) * cell;
+            double cy = -BUDDHABROT_DOMAIN + (index / IMPORTANCE_GRID + uniform(self->rng)) * cell;
+            int length = trace_orbit(cx, cy, max_iterations, self->orbit.data());
+            iterations += length;
+
+            const float contribution = total / (weight * ncells);
+            for (int i = 0; i < length; ++i)
+            {
+                int px = int((self->orbit[2 * i] - left) * sx);
+                int py = int((self->orbit[2 * i + 1] - bottom) * sy);
+                if (px >= 0 && px < width && py >= 0 && py < height)
+                    self->histogram[py * width + px] += contribution;
+            }
+        }
+
+        const uint64_t iterated = now_ns();
+        self->iterations += iterations;
+        self->iterate_ns += iterated - start;
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_merge >= MERGE_INTERVAL)
+        {
+            merge_histogram(ctx, self);
+            last_merge = now;
+            self->color_ns += now_ns() - iterated;
+        }
+        self->busy_ns += now_ns() - start;
+    }
+}
+
+// Pins the calling thread to the index-th CPU it is allowed to run on
+void
+pin_current_thread(int index)
+{
+#if defined(__linux__)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+    const int count = CPU_COUNT(&allowed);
+    int target = index % count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        if (target-- == 0)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            return;
+        }
+    }
+#elif defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), uintptr_t(1) << (index % (8 * sizeof(uintptr_t))));
+#else
+    (void) index; // No portable way to pin threads, e.g. on macOS
+#endif
+}
+
+worker_t *
+pick_queue(context_t *ctx, int id)
+{
+    const int nworkers = ctx->workers.size();
+    for (int i = 0; i < nworkers; ++i)
+    {
+        worker_t *queue = &ctx->workers[(id + i) % nworkers];
+        if (queue->active_tiles > 0) return queue;
+    }
+    return nullptr;
+}
+
+void
+worker(context_t *ctx, int id)
+{
+    worker_t *self = &ctx->workers[id];
+    if (ctx->pin_workers) pin_current_thread(id);
+
+    // First touch: the pages of owned tiles get allocated on this
+    // worker's NUMA node
+    for (int i : self->tiles)
+        memset((void *) tile_pixels(ctx, &ctx->tiles[i]), 0, TILE_SIZE * TILE_SIZE * sizeof(pixel_data_t));
+
+    for (;;)
+    {
+        uint64_t generation;
+        {
+            std::unique_lock<std::mutex> lock(ctx->lock);
+            ctx->parked++;
+            ctx->cv.notify_all();
+            ctx->cv.wait(lock, [ctx] {
+                return ctx->quit || (ctx->started == ctx->generation && ctx->active_tiles > 0);
+            });
+            if (ctx->quit) return;
+            ctx->parked--;
+            generation = ctx->started;
+        }
+
+        if (ctx->mode == RENDER_BUDDHABROT)
+        {
+            render_buddhabrot(ctx, self, generation);
+            continue;
+        }
+
+        // Tile boundary: drop the render as soon as it becomes stale
+        while (ctx->generation == generation && ctx->active_tiles > 0)
+        {
+            worker_t *queue = pick_queue(ctx, id);
+            if (!queue) break;
+            const uint64_t start = now_ns();
+            render_tile(ctx, self, queue, generation, queue->next_ticket++);
+            self->busy_ns += now_ns() - start;
+        }
+    }
+}
+
+// Stops the current render and waits until every worker has left its tile.
+// Context fields that workers read may only be changed between
+// cancel_render() and start_render().
+void
+cancel_render(context_t *ctx)
+{
+    std::unique_lock<std::mutex> lock(ctx->lock);
+    ctx->generation++;
+    ctx->cv.wait(lock, [ctx] { return ctx->parked == (int) ctx->workers.size(); });
+}
+
 void
-worker(context_t *context, const int offset, const int width, const int screen_height)
+start_render(context_t *ctx)
 {
-    for (int x = offset; x < offset + width; ++x)
+    std::lock_guard<std::mutex> lock(ctx->lock);
+    for (auto &worker : ctx->workers)
     {
-        for (int y = 0; y < screen_height; ++y)
+        worker.next_ticket = 0;
+        worker.active_tiles = worker.tiles.size();
+    }
+    ctx->active_tiles = ctx->tiles.size();
+    ctx->resolved_pixels = 0;
+    if (ctx->mode == RENDER_BUDDHABROT)
+    {
+        std::fill(ctx->density.begin(), ctx->density.end(), 0.0f);
+        std::fill(ctx->image.begin(), ctx->image.end(), BLACK);
+    }
+    ctx->started = ctx->generation;
+    ctx->cv.notify_all();
+}
+
+void
+init_render(context_t *ctx, int nworkers, bool pin_workers)
+{
+    const int width = ctx->screen_size.x;
+    const int height = ctx->screen_size.y;
+    const int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    const int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    ctx->image.assign(width * height, BLACK);
+    ctx->density.assign(width * height, 0.0f);
+    ctx->importance_iterations = 0;
+    ctx->importance_building = false;
+    ctx->tiles = std::vector<tile_t>(tiles_x * tiles_y);
+    ctx->workers = std::vector<worker_t>(nworkers);
+    ctx->pin_workers = pin_workers;
+    // Left untouched here, workers first-touch their own tiles
+    ctx->pixel_data = (pixel_data_t *) malloc(ctx->tiles.size() * TILE_SIZE * TILE_SIZE * sizeof(pixel_data_t));
+    for (int ty = 0; ty < tiles_y; ++ty)
+    {
+        for (int tx = 0; tx < tiles_x; ++tx)
         {
-            pixel_data_t *pixel = &context->pixel_data[x][y];
-            iterate(context, pixel);
+            tile_t *tile = &ctx->tiles[ty * tiles_x + tx];
+            tile->x0 = tx * TILE_SIZE;
+            tile->y0 = ty * TILE_SIZE;
+            tile->x1 = std::min(tile->x0 + TILE_SIZE, width);
+            tile->y1 = std::min(tile->y0 + TILE_SIZE, height);
+            // Never matches a real generation, so every tile starts stale
+            tile->generation = UINT64_MAX;
+            tile->active = false;
+            tile->owner = (ty * tiles_x + tx) % nworkers;
+            ctx->workers[tile->owner].tiles.push_back(ty * tiles_x + tx);
         }
-    } 
+    }
+
+    // Workers start parked and wait for the first start_render()
+    ctx->generation = 0;
+    ctx->started = UINT64_MAX;
+    ctx->parked = 0;
+    ctx->quit = false;
+    ctx->upload_ns = 0;
+    for (int i = 0; i < nworkers; ++i)
+    {
+        ctx->workers[i].rng.seed(std::random_device()() + i);
+        ctx->workers[i].iterations = 0;
+        ctx->workers[i].busy_ns = 0;
+        ctx->workers[i].iterate_ns = 0;
+        ctx->workers[i].color_ns = 0;
+        ctx->workers[i].thread = std::thread(&worker, ctx, i);
+    }
+    cancel_render(ctx);
+}
+
+void
+stop_render(context_t *ctx)
+{
+    cancel_render(ctx);
+    {
+        std::lock_guard<std::mutex> lock(ctx->lock);
+        ctx->quit = true;
+        ctx->cv.notify_all();
+    }
+    for (auto &worker : ctx->workers)
+        worker.thread.join();
+    free(ctx->pixel_data);
+}
+
+stats_t
+take_stats(context_t *ctx)
+{
+    stats_t stats = { now_ns(), 0, 0, 0, ctx->upload_ns, {} };
+    for (auto &worker : ctx->workers)
+    {
+        stats.iterations += worker.iterations;
+        stats.iterate_ns += worker.iterate_ns;
+        stats.color_ns += worker.color_ns;
+        stats.busy_ns.push_back(worker.busy_ns);
+    }
+    return stats;
+}
+
+stats_report_t
+report_stats(context_t *ctx, const stats_t &from, const stats_t &to)
+{
+    const double seconds = (to.time_ns - from.time_ns) * 1e-9;
+    const double pixels = ctx->screen_size.x * ctx->screen_size.y;
+    stats_report_t report = {
+        (to.iterations - from.iterations) / seconds,
+        ctx->resolved_pixels / pixels,
+        ctx->active_tiles,
+        (to.iterate_ns - from.iterate_ns) * 1e-6 / seconds,
+        (to.color_ns - from.color_ns) * 1e-6 / seconds,
+        (to.upload_ns - from.upload_ns) * 1e-6 / seconds,
+        {}, // busy
+    };
+    for (size_t i = 0; i < to.busy_ns.size(); ++i)
+        report.busy.push_back((to.busy_ns[i] - from.busy_ns[i]) * 1e-9 / seconds);
+    return report;
+}
+
+// One line of key=value pairs, for scripts that track render performance
+void
+print_stats(context_t *ctx, const stats_report_t &report)
+{
+    printf(
+        "stats mode=\"%s\" iterations_per_second=%.0f resolved=%.4f "
+        "queued_tiles=%d tiles=%d iterate_ms=%.1f color_ms=%.1f upload_ms=%.1f busy=",
+        render_mode_names[ctx->mode], report.iterations_per_second,
+        report.resolved, report.queued_tiles, (int) ctx->tiles.size(),
+        report.iterate_ms, report.color_ms, report.upload_ms
+    );
+    for (size_t i = 0; i < report.busy.size(); ++i)
+        printf(i == 0 ? "%.3f" : ",%.3f", report.busy[i]);
+    printf("\n");
+    fflush(stdout);
+}
+
+void
+draw_stats(context_t *ctx, const stats_report_t &report)
+{
+    const int font_size = 10;
+    const int line_height = 14;
+    const int nworkers = report.busy.size();
+    char line[256];
+
+    DrawRectangle(5, 5, 300, line_height * (6 + nworkers) + 10, { 0, 0, 0, 180 });
+    int y = 10;
+
+    snprintf(line, sizeof(line), "iterations: %.1fM/s", report.iterations_per_second * 1e-6);
+    DrawText(line, 10, y, font_size, WHITE);
+    y += line_height;
+
+    // Buddhabrot has neither tiles nor pixels that are ever done
+    if (ctx->mode == RENDER_BUDDHABROT)
+        snprintf(line, sizeof(line), "resolved: -");
+    else
+        snprintf(line, sizeof(line), "resolved: %.1f%%", report.resolved * 100);
+    DrawText(line, 10, y, font_size, WHITE);
+    y += line_height;
+
+    if (ctx->mode == RENDER_BUDDHABROT)
+        snprintf(line, sizeof(line), "tiles queued: -");
+    else
+        snprintf(line, sizeof(line), "tiles queued: %d / %d", report.queued_tiles, (int) ctx->tiles.size());
+    DrawText(line, 10, y, font_size, WHITE);
+    y += line_height;
+
+    snprintf(line, sizeof(line), "iterate: %.1f ms/s", report.iterate_ms);
+    DrawText(line, 10, y, font_size, WHITE);
+    y += line_height;
+    snprintf(line, sizeof(line), "color: %.1f ms/s", report.color_ms);
+    DrawText(line, 10, y, font_size, WHITE);
+    y += line_height;
+    snprintf(line, sizeof(line), "upload: %.1f ms/s", report.upload_ms);
+    DrawText(line, 10, y, font_size, WHITE);
+    y += line_height;
+
+    for (int i = 0; i < nworkers; ++i)
+    {
+        snprintf(line, sizeof(line), "worker %d busy: %.0f%%", i, report.busy[i] * 100);
+        DrawText(line, 10, y, font_size, WHITE);
+        DrawRectangle(160, y, int(130 * std::min(report.busy[i], 1.0)), font_size, GREEN);
+        y += line_height;
+    }
 }
 
 void
 set_viewport(context_t *context, Rectangle rect)
 {
+    cancel_render(context);
+
     v2d p0 = screen_to_local(context, v2d { rect.x, rect.y });
     v2d p1 = screen_to_local(context, v2d { rect.x + rect.width, rect.y + rect.height });
     context->viewport = viewport_t {
@@ -120,25 +897,27 @@ set_viewport(context_t *context, Rectangle rect)
         p1.y,
     };
 
-    for (long double x = 0; x < context->screen_size.x; x += 1)
-    {
-        for (long double y = 0; y < context->screen_size.y; y += 1)
-        {
-            v2d point = screen_to_local(context, v2d { x, y });
-            context->pixel_data[x][y] = pixel_data_t {
-                { 0, 0 }, // z
-                { point.x, point.y }, // c
-                0, // iteration
-                BLACK, // color
-                false, // done
-            };
-        }
-    }
+    // Pixel buffers are reused: each tile is reset by the first worker that
+    // visits it in the new generation
+    start_render(context);
 }
 
 int
-main(void)
+main(int argc, char **argv)
 {
+    // --pin: bind every worker to its own core, so that threads don't
+    // migrate away from the memory they first-touched
+    // --stats: print render counters to stdout once a second
+    bool pin_workers = false;
+    bool print_counters = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--pin") == 0)
+            pin_workers = true;
+        else if (strcmp(argv[i], "--stats") == 0)
+            print_counters = true;
+    }
+
     const int screen_width = 800;
     const int screen_height = 600;
     const float aspect = screen_width * 1.0 / screen_height;
@@ -146,16 +925,24 @@ main(void)
     InitWindow(screen_width, screen_height, "Creative Coding: Mandelbrot Set");
     SetTargetFPS(60);
 
-    context_t context = {
-        { screen_width, screen_height }, // screen_size
-        // Bottom and top are swapped for natural Y axis direction
-        { -2, 0.5, 1.12, -1.12 }, // viewport
-        100, // max_iterations
-        std::vector(screen_width, std::vector<pixel_data_t>(screen_height)),
-    };
+    // Everything else is set up by init_render()
+    context_t context = {};
+    context.screen_size = { screen_width, screen_height };
+    // Bottom and top are swapped for natural Y axis direction
+    context.viewport = { -2, 0.5, 1.12, -1.12 };
+    context.max_iterations = 100;
+    context.mode = RENDER_ESCAPE_TIME;
 
+    init_render(&context, std::max(1u, std::thread::hardware_concurrency()), pin_workers);
     set_viewport(&context, { 0, 0, screen_width, screen_height });
 
+    Texture2D texture = LoadTextureFromImage(GenImageColor(screen_width, screen_height, BLACK));
+    std::vector<Color> frame(screen_width * screen_height);
+
+    bool show_stats = false;
+    stats_t last_stats = take_stats(&context);
+    stats_report_t report = {};
+
     Rectangle selected_rect = { 0, 0, 0, 0 };
     bool selecting = false;
     while (!WindowShouldClose())
@@ -163,38 +950,33 @@ main(void)
         float deltatime = GetFrameTime();
         char title[128];
         sprintf(
-            title, "Creative Coding: Mandelbrot Set [fps = %f]",
-            1 / deltatime
+            title, "Creative Coding: Mandelbrot Set [fps = %f, mode = %s]",
+            1 / deltatime, render_mode_names[context.mode]
         );
         SetWindowTitle(title);
 
-        BeginDrawing();
+        // Workers keep rendering in the background, the frame only takes
+        // a snapshot of what is ready
+        const uint64_t upload_start = now_ns();
         {
-            ClearBackground(BLACK);
-
-            const int ncpu = std::thread::hardware_concurrency();
-            const int column_width = screen_width / ncpu;
-
-            std::vector<std::thread> threads(ncpu);
-            for (int i = 0; i < ncpu; ++i)
-            {
-                threads[i] = std::thread(&worker, &context, 
-                    i * column_width, column_width, screen_height);
-            }
+            std::lock_guard<std::mutex> guard(context.image_lock);
+            memcpy(frame.data(), context.image.data(), frame.size() * sizeof(Color));
+        }
+        UpdateTexture(texture, frame.data());
+        context.upload_ns += now_ns() - upload_start;
 
-            for (int i = 0; i < ncpu; ++i)
-            {
-                threads[i].join();
-            }            
+        if (now_ns() - last_stats.time_ns >= STATS_INTERVAL_NS)
+        {
+            stats_t stats = take_stats(&context);
+            report = report_stats(&context, last_stats, stats);
+            last_stats = stats;
+            if (print_counters) print_stats(&context, report);
+        }
 
-            for (int x = 0; x < screen_width; ++x)
-            {
-                for (int y = 0; y < screen_height; ++y)
-                {
-                    pixel_data_t *pixel = &context.pixel_data[x][y];
-                    DrawPixel(x, y, pixel->color);
-                }
-            }
+        BeginDrawing();
+        {
+            ClearBackground(BLACK);
+            DrawTexture(texture, 0, 0, WHITE);
 
             if (selecting)
             {
@@ -202,17 +984,29 @@ main(void)
                 DrawRectangleRec(fixed, { 255, 255, 255, 50 });
                 DrawRectangleLinesEx(fixed, 1, WHITE);
             }
-                
+
+            if (show_stats) draw_stats(&context, report);
         }
         EndDrawing();
 
+        if (IsKeyPressed(KEY_TAB))
+            show_stats = !show_stats;
+
         if (IsKeyPressed(KEY_SPACE))
         {
+            cancel_render(&context);
             context.viewport = { -2, 0.5, 1.12, -1.12 };
             context.max_iterations = 100;
             set_viewport(&context, { 0, 0, screen_width, screen_height });
         }
 
+        if (IsKeyPressed(KEY_D))
+        {
+            cancel_render(&context);
+            context.mode = render_mode_t((context.mode + 1) % RENDER_MODE_COUNT);
+            set_viewport(&context, { 0, 0, screen_width, screen_height });
+        }
+
         if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON))
         {
             selected_rect.x = float(GetMouseX());
@@ -231,6 +1025,7 @@ main(void)
         if (selecting && IsMouseButtonReleased(MOUSE_LEFT_BUTTON))
         {
             float area = std::abs(selected_rect.width * selected_rect.height);
+            cancel_render(&context);
             context.max_iterations *= sqrt(sqrt(log(area)));
             set_viewport(&context, fix_rect(selected_rect));
         }
@@ -242,6 +1037,8 @@ main(void)
         }
     }
 
+    stop_render(&context);
+    UnloadTexture(texture);
     CloseWindow();
 
     return 0;